@@ -1,174 +1,469 @@
-// MEMORY LEAKAGE TESTER
-
-#ifndef LEAKAGE_TEST_H
-#define LEAKAGE_TEST_H
-
-#include <cstdio>
-#include <cstdlib>
-#include <cstddef>
-#include <cstring>
-#include <exception>
-#include <new>
-
-#define INCLUDE_NOTIFICATIONS  __Tester__::notifications = true
-// #define EXCLUDE_NOTIFICATIONS __Tester__::notifications = false
- 
-#define FILE_OUTPUT(name) __Tester__::redirect_output(#name)
-#define SCREEN_OUTPUT __Tester__::redirect_output(0)
-
-namespace __Tester__ {
-  typedef unsigned long ULong; 
-  struct Info {
-    void *address;
-    long line;
-    std::size_t _size;
-    bool isArray;
-    Info *link;
-  } *alloc_map(0);
-  int alloc_count(0), dealloc_count(0);
-  long alloc_total(0), dealloc_total(0), alloc_current(0), 
-    alloc_max(0);
-  bool notifications(false);
-  char previous_name[1000] = "";
-  FILE *output(stdout);
-  void redirect_output(const char name[]) {
-    if(output != stdout) fclose(output);
-    if(name) {
-      if(strcmp(name, previous_name)) output = fopen(name, "w");
-      else output = fopen(name, "a");
-      if(output) {
-        strcpy(previous_name, name); return;          
-      }
-    }
-    output = stdout;
-  }
-  void *Alloc(long line, std::size_t _size, bool isArray) {
-    void *address(std::malloc(_size));
-    if(!address) throw std::bad_alloc();
-    if(line != -1) {
-      alloc_count++;
-      alloc_total += _size; alloc_current += _size;
-      if(alloc_current > alloc_max) alloc_max = alloc_current;
-      if(notifications) {
-        if(line == -2) std::fprintf(output, ">>> Internally allocated ");
-        else std::fprintf(output, ">>> in %ld. line of the script we have allocated memory with the line: ", line);
-        std::fprintf(output, "%lu bytes, on address %p\n", (ULong)_size, address);
-      }
-    }
-    Info info = {address, line, _size, isArray, alloc_map};
-    if(!(alloc_map = (Info*)std::malloc(sizeof(Info)))) 
-       throw std::bad_alloc(); 
-    *alloc_map = info;
-    return address;
-  }
-  void Dealloc(void *ptr, bool isArray) {
-    Info *current(alloc_map), *previous(0);
-    for(; current && current->address != ptr; current = current->link)
-      previous = current;           
-    if(current) {
-      if(current->line != -1) {
-        std::size_t _size(current->_size);
-        dealloc_count++;
-        dealloc_total += _size; alloc_current -= _size;
-        if(notifications) {
-          std::fprintf(output, ">>> Releasing %lu bytes on address %p\n", 
-            (ULong)_size, ptr);
-        }
-        if(isArray != current->isArray)
-          std::fprintf(output, "*** ERROR: Releasing on address %p %s "
-            "should be done with delete[]!\n", 
-            ptr, isArray ? "no" : "yes");
-      }
-      if(previous) previous->link = current->link;                   
-      else alloc_map = current->link;
-      std::free(current); std::free(ptr);     
-    }
-    else if(ptr) {
-      const std::size_t pomak(sizeof(std::size_t)); 
-      void *ptr1((char*)ptr + (isArray ? pomak : -pomak));
-      for(current = alloc_map; current && current->address != ptr1; 
-        current = current->link);
-      if(current)
-        std::fprintf(output, "*** ERROR: Releasing on address %p %s should "
-          "be done with delete[]!\n", ptr1, isArray ? "no" : "yes");
-      else              
-        fprintf(output, "*** ERROR: You are trying to release already released space "
-          "on address %p!\n", ptr);       
-    }  
-  }
-  void Terminator();
-  struct Reporter {
-    void (*old_terminator)();
-    Reporter() : old_terminator(std::set_terminate(Terminator)) {}
-    ~Reporter() {
-      std::fprintf(output, "\n\n+---------------+\n| FINAL REPORT: |\n"
-        "+---------------+\n\nTotal number of allocations: %d\nTotal number of "
-        "deallocations: %d\nTotal number of allocations in bytes: %ld\n"
-        "Total number of deallocations in bytes: %ld\nMaximum "
-        "memory occupation during runtime in bytes: %ld\nMemory occupation "
-        "upon completion: %ld\n", alloc_count,
-        dealloc_count, alloc_total, dealloc_total, 
-        alloc_max, alloc_current); 
-      if(alloc_map) {
-        std::fprintf(output, "\n\nLEAK! YOU HAVE MEMORY LEAKAGE ON FOLLOWING PLACES: \n");
-        for(Info *current = alloc_map; current; current = current->link)
-          if(current->line == -2)
-            std::fprintf(output, " - address %p, %lu bytes, allocated internally\n",
-              current->address, (ULong)current->_size);
-          else
-            std::fprintf(output, " - address %p, %lu bytes, allocated in %ld. "
-              "line\n", current->address, (ULong)current->_size, 
-              current->line);
-        std::fprintf(output, "\n");
-      }
-      else
-        std::fprintf(output, "\n\nGREAT JOB! YOU DO NOT HAVE MEMORY LEAKAGE\n\n");
-      if(output != stdout) fclose(output);  
-      std::system("PAUSE");
-    }  
-  } reporter;
-  void Terminator() {
-    reporter.Reporter::~Reporter();
-    reporter.old_terminator();
-  }   
-}
-
-void *operator new(std::size_t _size, long line) // throw(std::bad_alloc)
-{
-  return __Tester__::Alloc(line, _size, false);
-}
-
-void* operator new[](std::size_t _size, long line) // throw(std::bad_alloc)
-{
-  return __Tester__::Alloc(line, _size, true);
-}
-
-void *operator new(std::size_t _size) //   throw(std::bad_alloc)
-{
-  return __Tester__::Alloc(-2, _size, false); 
-}                                                    // Hvata interne alokacije
-
-void* operator new[](std::size_t _size) // throw(std::bad_alloc)
-{
-  return __Tester__::Alloc(-2, _size, true);
-}
-
-void operator delete(void *ptr) throw() {
-  __Tester__::Dealloc(ptr, false);
-}
- 
-void operator delete[](void* ptr) throw() {
-  __Tester__::Dealloc(ptr, true);   
-}
-
-void operator delete(void *ptr, long) throw() {    // placement delete!!!
-  __Tester__::Dealloc(ptr, false);
-}
- 
-void operator delete[](void* ptr, long) throw() {
-  __Tester__::Dealloc(ptr, true);   
-}
-
-#define new new(__LINE__)
- 
-#endif
+// MEMORY LEAKAGE TESTER
+
+#ifndef LEAKAGE_TEST_H
+#define LEAKAGE_TEST_H
+
+#include <atomic>
+#ifdef LEAK_PROFILE
+#include <chrono>
+#endif
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <new>
+
+#define INCLUDE_NOTIFICATIONS  __Tester__::notifications = true
+// #define EXCLUDE_NOTIFICATIONS __Tester__::notifications = false
+ 
+#define FILE_OUTPUT(name) __Tester__::redirect_output(#name)
+#define SCREEN_OUTPUT __Tester__::redirect_output(0)
+#ifdef LEAK_PROFILE
+#define PROFILE_OUTPUT(name) __Tester__::profile_output(#name)
+#else
+#define PROFILE_OUTPUT(name) ((void)0)
+#endif
+
+namespace __Tester__ {
+  typedef unsigned long ULong; 
+#ifdef LEAK_PROFILE
+  // Statistics of one call site, collected when compiled with
+  // -DLEAK_PROFILE. Sizes and lifetimes are counted in power of two
+  // buckets, bucket i holds values from 2^i up to 2^(i+1), the first
+  // one 0 as well and the last one everything larger. The members
+  // have no initializers: the table lives in static storage, and
+  // zero initialization must be all the construction it gets.
+  const int histogram_buckets(32);
+  struct Site {
+    std::atomic<const char*> file;   // set last, see find_site()
+    long line;
+    std::atomic<long> allocs, bytes, live, live_bytes, peak_live_bytes;
+    std::atomic<long> sizes[histogram_buckets];
+    std::atomic<long> lifetimes[histogram_buckets];   // microseconds
+  };
+#endif
+  struct Info {
+    void *address;
+    long line;
+    std::size_t _size;
+    bool isArray;
+    Info *link;
+#ifdef LEAK_PROFILE
+    Site *site;
+    std::uint64_t born;
+#endif
+  };
+  // The allocation map is split in shards picked by address, each
+  // with its own lock, table, Info pool and counters, so threads
+  // allocating at the same time rarely wait for each other.
+  const std::size_t shard_count(16);
+  // Info nodes are carved out of blocks of info_block nodes and
+  // reused after Dealloc, tracking costs no malloc of its own.
+  const std::size_t info_block(4096);
+  struct alignas(64) Shard {
+    std::mutex lock;
+    // Live allocations hashed by address, each bucket chained
+    // through Info::link. The table doubles once it holds more
+    // entries than buckets.
+    Info **alloc_map = 0;
+    std::size_t map_buckets = 0, map_entries = 0;
+    Info *free_infos = 0;
+    long alloc_count = 0, dealloc_count = 0, alloc_total = 0, dealloc_total = 0;
+  } shards[shard_count];
+  // Occupation is shared by every shard, its peak can't be
+  // put together from per shard counters.
+  std::atomic<long> alloc_current(0), alloc_max(0);
+  bool notifications(false);
+  char previous_name[1000] = "";
+  FILE *output(stdout);
+  void redirect_output(const char name[]) {
+    if(output != stdout) fclose(output);
+    if(name) {
+      if(strcmp(name, previous_name)) output = fopen(name, "w");
+      else output = fopen(name, "a");
+      if(output) {
+        strcpy(previous_name, name); return;          
+      }
+    }
+    output = stdout;
+  }
+#ifdef LEAK_PROFILE
+  // Sites are never removed, a full table leaves further
+  // sites unprofiled and counts their allocations here.
+  const std::size_t site_count(1024);
+  Site sites[site_count];
+  std::mutex site_lock;
+  std::atomic<long> unprofiled(0);
+  char profile_name[1000] = "leak_profile.json";
+  // Written when the report is, CSV if name ends in .csv, JSON otherwise.
+  void profile_output(const char name[]) {
+    std::strncpy(profile_name, name, sizeof(profile_name) - 1);
+  }
+  // Lookups don't lock, a slot is only claimed under site_lock
+  // and its file is published after its line.
+  Site *find_site(const char *file, long line) {
+    std::size_t start(line);
+    for(const char *c = file; *c; c++) start = start * 31 + *c;
+    for(std::size_t i = 0; i < site_count; i++) {
+      Site &site(sites[(start + i) & (site_count - 1)]);
+      const char *site_file(site.file.load(std::memory_order_acquire));
+      if(!site_file) {
+        std::lock_guard<std::mutex> guard(site_lock);
+        site_file = site.file.load(std::memory_order_relaxed);
+        if(!site_file) {
+          site.line = line; site.file.store(file, std::memory_order_release);
+          return &site;
+        }
+      }
+      // The same file may be named by different literals.
+      if(site.line == line && (site_file == file || !std::strcmp(site_file, file))) return &site;
+    }
+    return 0;
+  }
+  int log2_bucket(std::uint64_t value) {
+    int bucket(0);
+    while(value > 1 && bucket < histogram_buckets - 1) {
+      value >>= 1; bucket++;
+    }
+    return bucket;
+  }
+  std::uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  void profile_alloc(Info &info, const char *file) {
+    info.site = find_site(file ? file : "(internal)", info.line);
+    if(!info.site) {
+      unprofiled.fetch_add(1, std::memory_order_relaxed); return;
+    }
+    Site &site(*info.site);
+    long _size(info._size);
+    site.allocs.fetch_add(1, std::memory_order_relaxed);
+    site.bytes.fetch_add(_size, std::memory_order_relaxed);
+    site.live.fetch_add(1, std::memory_order_relaxed);
+    long live(site.live_bytes.fetch_add(_size, std::memory_order_relaxed) + _size);
+    long peak(site.peak_live_bytes.load(std::memory_order_relaxed));
+    while(live > peak && !site.peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+    site.sizes[log2_bucket(_size)].fetch_add(1, std::memory_order_relaxed);
+    info.born = now_us();
+  }
+  void profile_dealloc(const Info &info) {
+    if(!info.site) return;
+    Site &site(*info.site);
+    site.live.fetch_sub(1, std::memory_order_relaxed);
+    site.live_bytes.fetch_sub(info._size, std::memory_order_relaxed);
+    site.lifetimes[log2_bucket(now_us() - info.born)].fetch_add(1, std::memory_order_relaxed);
+  }
+  int by_bytes(const void *a, const void *b) {
+    long bytes_a((*(Site* const*)a)->bytes.load()), bytes_b((*(Site* const*)b)->bytes.load());
+    return bytes_a < bytes_b ? 1 : (bytes_a > bytes_b ? -1 : 0);
+  }
+  // Histograms are written up to their last non-empty bucket.
+  void write_histogram(FILE *file, const std::atomic<long> *histogram, const char *separator) {
+    int used(histogram_buckets);
+    while(used > 0 && !histogram[used - 1].load()) used--;
+    for(int i = 0; i < used; i++)
+      std::fprintf(file, "%s%ld", i ? separator : "", histogram[i].load());
+  }
+  void write_json_string(FILE *file, const char *text) {
+    std::fputc('"', file);
+    for(const char *c = text; *c; c++) {
+      if(*c == '"' || *c == '\\') std::fputc('\\', file);
+      std::fputc(*c, file);
+    }
+    std::fputc('"', file);
+  }
+  // Sites sorted by the bytes they allocated, the ones
+  // worth a pool of their own come first.
+  void write_profile() {
+    Site *used[site_count];
+    std::size_t count(0);
+    for(std::size_t i = 0; i < site_count; i++)
+      if(sites[i].file.load(std::memory_order_acquire)) used[count++] = &sites[i];
+    std::qsort(used, count, sizeof(Site*), by_bytes);
+    FILE *file(std::fopen(profile_name, "w"));
+    if(!file) {
+      std::fprintf(output, "*** ERROR: Can't write the allocation profile to %s!\n", profile_name);
+      return;
+    }
+    std::size_t length(std::strlen(profile_name));
+    bool csv(length >= 4 && !std::strcmp(profile_name + length - 4, ".csv"));
+    if(csv)
+      std::fprintf(file, "file,line,allocs,bytes,live,live_bytes,peak_live_bytes,"
+        "size_histogram,lifetime_us_histogram\n");
+    else
+      std::fprintf(file, "{\"histogram_base\": 2, \"unprofiled_allocs\": %ld, \"sites\": [",
+        unprofiled.load());
+    for(std::size_t i = 0; i < count; i++) {
+      Site &site(*used[i]);
+      if(csv) {
+        std::fputc('"', file);
+        for(const char *c = site.file.load(); *c; c++) {
+          if(*c == '"') std::fputc('"', file);
+          std::fputc(*c, file);
+        }
+        std::fprintf(file, "\",");
+      }
+      else {
+        std::fprintf(file, "%s\n  {\"file\": ", i ? "," : "");
+        write_json_string(file, site.file.load());
+        std::fprintf(file, ", ");
+      }
+      std::fprintf(file, csv ? "%ld,%ld,%ld,%ld,%ld,%ld," :
+        "\"line\": %ld, \"allocs\": %ld, \"bytes\": %ld, \"live\": %ld, "
+        "\"live_bytes\": %ld, \"peak_live_bytes\": %ld, \"size_histogram\": [",
+        site.line, site.allocs.load(), site.bytes.load(), site.live.load(),
+        site.live_bytes.load(), site.peak_live_bytes.load());
+      write_histogram(file, site.sizes, csv ? ";" : ", ");
+      std::fprintf(file, csv ? "," : "], \"lifetime_us_histogram\": [");
+      write_histogram(file, site.lifetimes, csv ? ";" : ", ");
+      std::fprintf(file, csv ? "\n" : "]}");
+    }
+    if(!csv) std::fprintf(file, "\n]}\n");
+    std::fclose(file);
+  }
+#endif
+  std::uint64_t hash_of(void *address) {
+    std::uint64_t key((std::uintptr_t)address >> 4);   // allocations are aligned
+    return (key ^ (key >> 12)) * 0x9E3779B97F4A7C15ull;
+  }
+  // The shard takes the top bits of the hash, buckets lower ones.
+  Shard &shard_of(void *address) {
+    return shards[hash_of(address) >> 60];
+  }
+  std::size_t bucket_of(void *address, std::size_t buckets) {
+    return (hash_of(address) >> 16) & (buckets - 1);
+  }
+  void grow_map(Shard &shard) {
+    std::size_t buckets(shard.map_buckets ? shard.map_buckets * 2 : 1024);
+    Info **table((Info**)std::calloc(buckets, sizeof(Info*)));
+    if(!table) throw std::bad_alloc();
+    for(std::size_t i = 0; i < shard.map_buckets; i++)
+      for(Info *current = shard.alloc_map[i], *next; current; current = next) {
+        next = current->link;
+        Info *&head(table[bucket_of(current->address, buckets)]);
+        current->link = head; head = current;
+      }
+    std::free(shard.alloc_map);
+    shard.alloc_map = table; shard.map_buckets = buckets;
+  }
+  Info *new_info(Shard &shard) {
+    if(!shard.free_infos) {
+      Info *block((Info*)std::malloc(info_block * sizeof(Info)));
+      if(!block) throw std::bad_alloc();
+      for(std::size_t i = 0; i < info_block; i++) {
+        block[i].link = shard.free_infos; shard.free_infos = block + i;
+      }
+    }
+    Info *info(shard.free_infos);
+    shard.free_infos = info->link;
+    return info;
+  }
+  // The link pointing at the entry of address, or at the null
+  // link ending its bucket if it isn't allocated. The shard of
+  // address must be locked.
+  Info **find_info(Shard &shard, void *address) {
+    if(!shard.map_buckets) grow_map(shard);
+    Info **current(&shard.alloc_map[bucket_of(address, shard.map_buckets)]);
+    while(*current && (*current)->address != address) current = &(*current)->link;
+    return current;
+  }
+  bool is_allocated(void *address) {
+    Shard &shard(shard_of(address));
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return *find_info(shard, address) != 0;
+  }
+  void *Alloc(long line, std::size_t _size, bool isArray, const char *file = 0) {
+    void *address(std::malloc(_size));
+    if(!address) throw std::bad_alloc();
+    Shard &shard(shard_of(address));
+    std::lock_guard<std::mutex> guard(shard.lock);
+    // The bookkeeping may run out of memory as well, the block is
+    // given back then and nothing counted, as if new had failed.
+    Info *info;
+    try {
+      if(shard.map_entries >= shard.map_buckets) grow_map(shard);
+      info = new_info(shard);
+    } catch(...) {
+      std::free(address); throw;
+    }
+    if(line != -1) {
+      shard.alloc_count++; shard.alloc_total += _size;
+      long current(alloc_current.fetch_add(_size, std::memory_order_relaxed) + _size);
+      long max(alloc_max.load(std::memory_order_relaxed));
+      while(current > max && !alloc_max.compare_exchange_weak(max, current, std::memory_order_relaxed));
+      if(notifications) {
+        if(line == -2) std::fprintf(output, ">>> Internally allocated ");
+        else std::fprintf(output, ">>> in %ld. line of the script we have allocated memory with the line: ", line);
+        std::fprintf(output, "%lu bytes, on address %p\n", (ULong)_size, address);
+      }
+    }
+    Info *&head(shard.alloc_map[bucket_of(address, shard.map_buckets)]);
+#ifdef LEAK_PROFILE
+    *info = {address, line, _size, isArray, head, 0, 0};
+    if(line != -1) profile_alloc(*info, file);
+#else
+    *info = {address, line, _size, isArray, head};
+    (void)file;
+#endif
+    head = info; shard.map_entries++;
+    return address;
+  }
+  void Dealloc(void *ptr, bool isArray) {
+    {
+      Shard &shard(shard_of(ptr));
+      std::lock_guard<std::mutex> guard(shard.lock);
+      Info **slot(find_info(shard, ptr)), *current(*slot);
+      if(current) {
+        if(current->line != -1) {
+#ifdef LEAK_PROFILE
+          profile_dealloc(*current);
+#endif
+          std::size_t _size(current->_size);
+          shard.dealloc_count++; shard.dealloc_total += _size;
+          alloc_current.fetch_sub(_size, std::memory_order_relaxed);
+          if(notifications) {
+            std::fprintf(output, ">>> Releasing %lu bytes on address %p\n", 
+              (ULong)_size, ptr);
+          }
+          if(isArray != current->isArray)
+            std::fprintf(output, "*** ERROR: Releasing on address %p %s "
+              "should be done with delete[]!\n", 
+              ptr, isArray ? "no" : "yes");
+        }
+        *slot = current->link; shard.map_entries--;
+        current->link = shard.free_infos; shard.free_infos = current;
+        std::free(ptr);     
+        return;
+      }
+    }
+    if(ptr) {
+      // The neighbouring address may live in another shard.
+      const std::size_t pomak(sizeof(std::size_t)); 
+      void *ptr1((char*)ptr + (isArray ? pomak : -pomak));
+      if(is_allocated(ptr1))
+        std::fprintf(output, "*** ERROR: Releasing on address %p %s should "
+          "be done with delete[]!\n", ptr1, isArray ? "no" : "yes");
+      else              
+        fprintf(output, "*** ERROR: You are trying to release already released space "
+          "on address %p!\n", ptr);       
+    }  
+  }
+  void Terminator();
+  struct Reporter {
+    void (*old_terminator)();
+    Reporter() : old_terminator(std::set_terminate(Terminator)) {}
+    ~Reporter() {
+      long alloc_count(0), dealloc_count(0), alloc_total(0), dealloc_total(0);
+      std::size_t leaks(0);
+      for(std::size_t i = 0; i < shard_count; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        alloc_count += shards[i].alloc_count; dealloc_count += shards[i].dealloc_count;
+        alloc_total += shards[i].alloc_total; dealloc_total += shards[i].dealloc_total;
+        leaks += shards[i].map_entries;
+      }
+      std::fprintf(output, "\n\n+---------------+\n| FINAL REPORT: |\n"
+        "+---------------+\n\nTotal number of allocations: %ld\nTotal number of "
+        "deallocations: %ld\nTotal number of allocations in bytes: %ld\n"
+        "Total number of deallocations in bytes: %ld\nMaximum "
+        "memory occupation during runtime in bytes: %ld\nMemory occupation "
+        "upon completion: %ld\n", alloc_count,
+        dealloc_count, alloc_total, dealloc_total, 
+        alloc_max.load(), alloc_current.load()); 
+      if(leaks) {
+        std::fprintf(output, "\n\nLEAK! YOU HAVE MEMORY LEAKAGE ON FOLLOWING PLACES: \n");
+        for(std::size_t s = 0; s < shard_count; s++) {
+          std::lock_guard<std::mutex> guard(shards[s].lock);
+          for(std::size_t i = 0; i < shards[s].map_buckets; i++)
+            for(Info *current = shards[s].alloc_map[i]; current; current = current->link)
+              if(current->line == -2)
+                std::fprintf(output, " - address %p, %lu bytes, allocated internally\n",
+                  current->address, (ULong)current->_size);
+              else
+                std::fprintf(output, " - address %p, %lu bytes, allocated in %ld. "
+                  "line\n", current->address, (ULong)current->_size, 
+                  current->line);
+        }
+        std::fprintf(output, "\n");
+      }
+      else
+        std::fprintf(output, "\n\nGREAT JOB! YOU DO NOT HAVE MEMORY LEAKAGE\n\n");
+#ifdef LEAK_PROFILE
+      write_profile();
+#endif
+      if(output != stdout) fclose(output);  
+      std::system("PAUSE");
+    }  
+  } reporter;
+  void Terminator() {
+    reporter.Reporter::~Reporter();
+    reporter.old_terminator();
+  }   
+}
+
+void *operator new(std::size_t _size, long line) // throw(std::bad_alloc)
+{
+  return __Tester__::Alloc(line, _size, false);
+}
+
+void* operator new[](std::size_t _size, long line) // throw(std::bad_alloc)
+{
+  return __Tester__::Alloc(line, _size, true);
+}
+
+#ifdef LEAK_PROFILE
+void *operator new(std::size_t _size, const char *file, long line)
+{
+  return __Tester__::Alloc(line, _size, false, file);
+}
+
+void* operator new[](std::size_t _size, const char *file, long line)
+{
+  return __Tester__::Alloc(line, _size, true, file);
+}
+#endif
+
+void *operator new(std::size_t _size) //   throw(std::bad_alloc)
+{
+  return __Tester__::Alloc(-2, _size, false); 
+}                                                    // Hvata interne alokacije
+
+void* operator new[](std::size_t _size) // throw(std::bad_alloc)
+{
+  return __Tester__::Alloc(-2, _size, true);
+}
+
+void operator delete(void *ptr) throw() {
+  __Tester__::Dealloc(ptr, false);
+}
+ 
+void operator delete[](void* ptr) throw() {
+  __Tester__::Dealloc(ptr, true);   
+}
+
+void operator delete(void *ptr, long) throw() {    // placement delete!!!
+  __Tester__::Dealloc(ptr, false);
+}
+ 
+void operator delete[](void* ptr, long) throw() {
+  __Tester__::Dealloc(ptr, true);   
+}
+
+#ifdef LEAK_PROFILE
+void operator delete(void *ptr, const char *, long) throw() {
+  __Tester__::Dealloc(ptr, false);
+}
+
+void operator delete[](void* ptr, const char *, long) throw() {
+  __Tester__::Dealloc(ptr, true);
+}
+
+#define new new(__FILE__, __LINE__)
+#else
+#define new new(__LINE__)
+#endif
+ 
+#endif
@@ -0,0 +1,688 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include "gc_dump.h"
+#include "gc_pointer.h"
+#include "gc_weak.h"
+
+// Keep n objects alive in the registry for the duration of a benchmark
+// so the cost of every operation can be measured against a large heap.
+static std::vector<Pointer<int> > make_live_set(size_t n)
+{
+    std::vector<Pointer<int> > live;
+    live.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        live.emplace_back(new int(static_cast<int>(i)));
+    }
+    return live;
+}
+
+// Adopt a fresh allocation and release it again.
+static void BM_AdoptRelease(benchmark::State& state)
+{
+    std::vector<Pointer<int> > live = make_live_set(state.range(0));
+    for (auto _ : state)
+    {
+        Pointer<int> p(new int(1));
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Create an object through make_gc() and release it,
+// compared with adoption and std::make_shared.
+static void BM_MakeRelease(benchmark::State& state)
+{
+    std::vector<Pointer<int> > live = make_live_set(state.range(0));
+    for (auto _ : state)
+    {
+        Pointer<int> p = make_gc<int>(1);
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// make_gc() on several threads with the pools split per NUMA node
+// (Arg 1) or shared (Arg 0). On a single node host this measures what
+// looking up the arena costs.
+static void BM_ConcurrentMakeNodeArenas(benchmark::State& state)
+{
+    if (state.thread_index() == 0)
+    {
+        gc::set_node_arenas(state.range(0) != 0);
+    }
+    for (auto _ : state)
+    {
+        ConcurrentPointer<int> p = ConcurrentPointer<int>::make(1);
+        benchmark::DoNotOptimize(&*p);
+    }
+    if (state.thread_index() == 0)
+    {
+        gc::set_node_arenas(false);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// The same with std::shared_ptr and with a raw new and delete.
+static void BM_AdoptReleaseSharedPtr(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        std::shared_ptr<int> p(new int(1));
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_NewDeleteRaw(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        int* p = new int(1);
+        benchmark::DoNotOptimize(p);
+        delete p;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_MakeSharedRelease(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        std::shared_ptr<int> p = std::make_shared<int>(1);
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Copy an already registered Pointer and drop the copy.
+static void BM_CopyRelease(benchmark::State& state)
+{
+    std::vector<Pointer<int> > live = make_live_set(state.range(0));
+    Pointer<int>& src = live[live.size() / 2];
+    for (auto _ : state)
+    {
+        Pointer<int> p(src);
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// An object counting its own references, see gc::IntrusiveBase.
+struct IntrusiveInt : gc::IntrusiveBase
+{
+    int value_;
+
+    explicit IntrusiveInt(int value) : value_(value) {}
+};
+
+static void BM_IntrusiveMakeRelease(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        Pointer<IntrusiveInt> p = make_gc<IntrusiveInt>(1);
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_IntrusiveCopyRelease(benchmark::State& state)
+{
+    Pointer<IntrusiveInt> src = make_gc<IntrusiveInt>(1);
+    for (auto _ : state)
+    {
+        Pointer<IntrusiveInt> p(src);
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_CopyReleaseSharedPtr(benchmark::State& state)
+{
+    std::shared_ptr<int> src = std::make_shared<int>(1);
+    for (auto _ : state)
+    {
+        std::shared_ptr<int> p(src);
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Reassign a Pointer between two live objects.
+static void BM_Assign(benchmark::State& state)
+{
+    std::vector<Pointer<int> > live = make_live_set(state.range(0));
+    Pointer<int> p;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        p = live[i & 1];
+        i++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Time the releasing thread spends dropping the last Pointer to
+// 1000 objects. Arg 1 hands them to the background collector.
+static void BM_ReleaseLargeGraph(benchmark::State& state)
+{
+    if (state.range(0) != 0)
+    {
+        gc::start_background_collector(1 << 16);
+    }
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        std::vector<ConcurrentPointer<int> >* graph = new std::vector<ConcurrentPointer<int> >();
+        for (int i = 0; i < 1000; i++)
+        {
+            graph->emplace_back(new int(i));
+        }
+        state.ResumeTiming();
+        delete graph;
+    }
+    gc::stop_background_collector();
+    state.SetItemsProcessed(state.iterations() * 1000);
+}
+
+// Sum a managed array through the bounds checked operator[] and
+// Iter, through span() and through a raw pointer.
+static void BM_SumIndexed(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    Pointer<int[]> buffer = make_gc_array<int>(n);
+    for (auto _ : state)
+    {
+        int sum = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            sum += buffer[i];
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// operator[] of a Pointer with the gc::Unchecked policy.
+static void BM_SumIndexedUnchecked(benchmark::State& state)
+{
+    using Unchecked = gc::Policy<gc::SingleThreaded, gc::RuntimeCollection, gc::Unchecked>;
+    size_t n = state.range(0);
+    Pointer<int[], 0, Unchecked> buffer = Pointer<int[], 0, Unchecked>::make_array(n);
+    for (auto _ : state)
+    {
+        int sum = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            sum += buffer[i];
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_SumIter(benchmark::State& state)
+{
+    Pointer<int[]> buffer = make_gc_array<int>(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(std::accumulate(buffer.begin(), buffer.end(), 0));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_SumSpan(benchmark::State& state)
+{
+    Pointer<int[]> buffer = make_gc_array<int>(state.range(0));
+    for (auto _ : state)
+    {
+        gc::Span<int> span = buffer.span();
+        benchmark::DoNotOptimize(std::accumulate(span.begin(), span.end(), 0));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_SumRawPointer(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    int* buffer = new int[n]();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(std::accumulate(buffer, buffer + n, 0));
+    }
+    delete[] buffer;
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Look an object up through a WeakPointer the way a cache
+// would, compared with std::weak_ptr.
+static void BM_WeakLock(benchmark::State& state)
+{
+    Pointer<int> strong = make_gc<int>(1);
+    WeakPointer<int> weak = strong;
+    for (auto _ : state)
+    {
+        Pointer<int> p = weak.lock();
+        benchmark::DoNotOptimize(p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_WeakPtrLock(benchmark::State& state)
+{
+    std::shared_ptr<int> strong = std::make_shared<int>(1);
+    std::weak_ptr<int> weak = strong;
+    for (auto _ : state)
+    {
+        std::shared_ptr<int> p = weak.lock();
+        benchmark::DoNotOptimize(p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Grow a vector of Pointers one element at a time, reallocations
+// included, and compare it with the same pattern on shared_ptr.
+static void BM_VectorGrowPointer(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        std::vector<Pointer<int> > v;
+        for (int64_t i = 0; i < state.range(0); i++)
+        {
+            v.push_back(Pointer<int>(new int(static_cast<int>(i))));
+        }
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_VectorGrowSharedPtr(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        std::vector<std::shared_ptr<int> > v;
+        for (int64_t i = 0; i < state.range(0); i++)
+        {
+            v.push_back(std::shared_ptr<int>(new int(static_cast<int>(i))));
+        }
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Destroy a batch of Pointers under each collect policy and pay
+// for whatever collection the policy left behind.
+static void BM_DestroyBatch(benchmark::State& state)
+{
+    gc::set_collect_policy(static_cast<gc::CollectPolicy>(state.range(0)));
+    for (auto _ : state)
+    {
+        {
+            std::vector<Pointer<int> > batch = make_live_set(state.range(1));
+        }
+        Pointer<int>::collect();
+    }
+    gc::set_collect_policy(gc::CollectPolicy::Immediate);
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+// Build and drop a batch of concurrent Pointers, Arg 1 adopting it with
+// adopt_many() and dropping it inside a gc::ReleaseScope, Arg 0 one
+// Pointer at a time. Adopting and releasing one by one takes a shard
+// lock per object.
+static void BM_BatchAdoptRelease(benchmark::State& state)
+{
+    const size_t n = 10000;
+    std::vector<int*> mems(n);
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            mems[i] = new int(static_cast<int>(i));
+        }
+        if (state.range(0) != 0)
+        {
+            gc::ReleaseScope scope;
+            std::vector<ConcurrentPointer<int> > batch =
+                ConcurrentPointer<int>::adopt_many(gc::Span<int* const>(mems.data(), n));
+            benchmark::DoNotOptimize(batch.data());
+        }
+        else
+        {
+            std::vector<ConcurrentPointer<int> > batch;
+            batch.reserve(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                batch.emplace_back(mems[i]);
+            }
+            benchmark::DoNotOptimize(batch.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_AssignSharedPtr(benchmark::State& state)
+{
+    std::shared_ptr<int> live[2] = {std::make_shared<int>(1), std::make_shared<int>(2)};
+    std::shared_ptr<int> p;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        p = live[i & 1];
+        i++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_AssignRaw(benchmark::State& state)
+{
+    int a = 1;
+    int b = 2;
+    int* live[2] = {&a, &b};
+    int* p = nullptr;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        p = live[i & 1];
+        benchmark::DoNotOptimize(p);
+        i++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Time collect() over 100000 entries of which Arg percent are
+// garbage, the rest stays referenced.
+static void BM_CollectGarbageRatio(benchmark::State& state)
+{
+    const size_t entries = 100000;
+    const size_t garbage = entries * state.range(0) / 100;
+    gc::set_collect_policy(gc::CollectPolicy::Explicit);
+    std::vector<Pointer<int> > live = make_live_set(entries - garbage);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        {
+            std::vector<Pointer<int> > batch = make_live_set(garbage);
+        }
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(Pointer<int>::collect());
+    }
+    gc::set_collect_policy(gc::CollectPolicy::Immediate);
+    state.SetItemsProcessed(state.iterations() * entries);
+}
+
+// Churn through garbage under the Explicit policy with only the
+// heap budget to free it. Arg is the budget in KiB, peak_bytes
+// reports the largest heap seen.
+static void BM_BudgetedChurn(benchmark::State& state)
+{
+    gc::set_collect_policy(gc::CollectPolicy::Explicit);
+    gc::set_heap_budget(state.range(0) * 1024);
+    size_t peak = 0;
+    for (auto _ : state)
+    {
+        Pointer<int> p = make_gc<int>(1);
+        peak = std::max(peak, gc::registry<gc::SingleThreaded>().live_bytes());
+    }
+    gc::set_heap_budget(0);
+    Pointer<int>::collect();
+    gc::set_collect_policy(gc::CollectPolicy::Immediate);
+    state.counters["peak_bytes"] = static_cast<double>(peak);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Short lived objects under the Threshold policy next to a long
+// lived set of 100000. Arg is the nursery size, 0 sends every object
+// through the registry and each collection walks the long lived set.
+static void BM_NurseryChurn(benchmark::State& state)
+{
+    std::vector<Pointer<int> > live = make_live_set(100000);
+    gc::set_collect_policy(gc::CollectPolicy::Threshold);
+    gc::set_nursery_size(state.range(0));
+    for (auto _ : state)
+    {
+        Pointer<int> p = make_gc<int>(1);
+        benchmark::DoNotOptimize(&*p);
+    }
+    gc::set_nursery_size(0);
+    Pointer<int>::collect();
+    gc::set_collect_policy(gc::CollectPolicy::Immediate);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Time a single collect() after n entries dropped to zero at once.
+static void BM_CollectAllGarbage(benchmark::State& state)
+{
+    gc::set_collect_policy(gc::CollectPolicy::Explicit);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        {
+            std::vector<Pointer<int> > batch = make_live_set(state.range(0));
+        }
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(Pointer<int>::collect());
+    }
+    gc::set_collect_policy(gc::CollectPolicy::Immediate);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetComplexityN(state.range(0));
+}
+
+// Write a snapshot of n live objects to a temporary file.
+static void BM_DumpHeap(benchmark::State& state)
+{
+    std::vector<Pointer<int> > live = make_live_set(state.range(0));
+    std::FILE* file = std::tmpfile();
+    for (auto _ : state)
+    {
+        std::rewind(file);
+        benchmark::DoNotOptimize(gc::dump_heap(file, false));
+    }
+    std::fclose(file);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Pauses of single collections over a registry of 1M live objects
+// while garbage trickles in, the way an event loop would spend its
+// idle slots. Arg is the entry budget of an incremental step, 0 runs
+// full collect() calls. p50, p99 and the longest pause are reported.
+static void BM_CollectPause(benchmark::State& state)
+{
+    gc::set_collect_policy(gc::CollectPolicy::Explicit);
+    std::vector<Pointer<int> > live = make_live_set(1000000);
+    gc::CollectBudget budget;
+    budget.entries = state.range(0);
+    std::vector<double> pauses;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (int i = 0; i < 100; i++)
+        {
+            Pointer<int> p = make_gc<int>(i);
+        }
+        state.ResumeTiming();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (budget.entries != 0)
+        {
+            benchmark::DoNotOptimize(Pointer<int>::collect_incremental(budget));
+        }
+        else
+        {
+            benchmark::DoNotOptimize(Pointer<int>::collect());
+        }
+        pauses.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    Pointer<int>::collect();
+    gc::set_collect_policy(gc::CollectPolicy::Immediate);
+
+    std::sort(pauses.begin(), pauses.end());
+    state.counters["p50_us"] = pauses[pauses.size() / 2];
+    state.counters["p99_us"] = pauses[pauses.size() * 99 / 100];
+    state.counters["max_us"] = pauses.back();
+}
+
+// Two objects that point at each other, only collect_cycles()
+// can free them.
+struct RingNode
+{
+    Pointer<RingNode> next;
+};
+
+namespace gc {
+template <>
+struct Children<RingNode>
+{
+    static const bool traced = true;
+
+    template <class Visitor>
+    static void visit(RingNode& node, Visitor& visitor)
+    {
+        visitor(node.next);
+    }
+};
+} // namespace gc
+
+static void BM_CollectCycles(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (int64_t i = 0; i < state.range(0); i++)
+        {
+            Pointer<RingNode> a = make_gc<RingNode>();
+            a->next = make_gc<RingNode>();
+            a->next->next = a;
+        }
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(Pointer<RingNode>::collect_cycles());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetComplexityN(state.range(0));
+}
+
+// Pauses of cycle collection with 100000 live rings in the heap and
+// 100 garbage rings made between collections. Arg is the budget of a
+// collect_cycles_incremental() step, 0 runs full collect_cycles().
+static void BM_CollectCyclesPause(benchmark::State& state)
+{
+    std::vector<Pointer<RingNode> > live;
+    for (int i = 0; i < 100000; i++)
+    {
+        live.push_back(make_gc<RingNode>());
+        live.back()->next = make_gc<RingNode>();
+        live.back()->next->next = live.back();
+    }
+    gc::CollectBudget budget;
+    budget.entries = state.range(0);
+    std::vector<double> pauses;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (int i = 0; i < 100; i++)
+        {
+            Pointer<RingNode> a = make_gc<RingNode>();
+            a->next = make_gc<RingNode>();
+            a->next->next = a;
+        }
+        state.ResumeTiming();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (budget.entries != 0)
+        {
+            benchmark::DoNotOptimize(Pointer<RingNode>::collect_cycles_incremental(budget));
+        }
+        else
+        {
+            benchmark::DoNotOptimize(Pointer<RingNode>::collect_cycles());
+        }
+        pauses.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    live.clear();
+    Pointer<RingNode>::collect_cycles();
+
+    std::sort(pauses.begin(), pauses.end());
+    state.counters["p50_us"] = pauses[pauses.size() / 2];
+    state.counters["p99_us"] = pauses[pauses.size() * 99 / 100];
+    state.counters["max_us"] = pauses.back();
+}
+
+// One object shared by every benchmark thread, copies
+// all hit the same reference count.
+static ConcurrentPointer<int> sSharedSource(new int(1));
+
+static void BM_ConcurrentCopyRelease(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        ConcurrentPointer<int> p(sSharedSource);
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Every thread adopts and releases its own objects, spreading the
+// work over the registry shards. The argument is the thread cache
+// size, with a cache the registry isn't touched at all.
+static void BM_ConcurrentAdoptRelease(benchmark::State& state)
+{
+    if (state.thread_index() == 0)
+    {
+        gc::set_thread_cache(state.range(0), 0);
+    }
+    for (auto _ : state)
+    {
+        ConcurrentPointer<int> p(new int(1));
+        ConcurrentPointer<int> q(p);
+        benchmark::DoNotOptimize(&*q);
+    }
+    if (state.thread_index() == 0)
+    {
+        gc::set_thread_cache(0, 0);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_AdoptRelease)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(BM_MakeRelease)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(BM_ConcurrentMakeNodeArenas)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_AdoptReleaseSharedPtr);
+BENCHMARK(BM_NewDeleteRaw);
+BENCHMARK(BM_MakeSharedRelease);
+BENCHMARK(BM_CopyRelease)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(BM_CopyReleaseSharedPtr);
+BENCHMARK(BM_IntrusiveMakeRelease);
+BENCHMARK(BM_IntrusiveCopyRelease);
+BENCHMARK(BM_Assign)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(BM_AssignSharedPtr);
+BENCHMARK(BM_AssignRaw);
+BENCHMARK(BM_DestroyBatch)->ArgsProduct({
+    {static_cast<int64_t>(gc::CollectPolicy::Immediate),
+     static_cast<int64_t>(gc::CollectPolicy::Threshold),
+     static_cast<int64_t>(gc::CollectPolicy::Explicit)},
+    {100000}});
+BENCHMARK(BM_BatchAdoptRelease)->Arg(0)->Arg(1);
+BENCHMARK(BM_BudgetedChurn)->Arg(64)->Arg(1024);
+BENCHMARK(BM_NurseryChurn)->Arg(0)->Arg(256);
+BENCHMARK(BM_CollectGarbageRatio)->Arg(0)->Arg(10)->Arg(50)->Arg(90);
+BENCHMARK(BM_CollectAllGarbage)->RangeMultiplier(10)->Range(10000, 1000000)->Complexity(benchmark::oN);
+BENCHMARK(BM_DumpHeap)->Arg(10000)->Arg(1000000);
+BENCHMARK(BM_CollectPause)->Arg(0)->Arg(1000)->Arg(10000)->Iterations(500);
+BENCHMARK(BM_CollectCycles)->RangeMultiplier(10)->Range(1000, 100000)->Complexity(benchmark::oN);
+BENCHMARK(BM_CollectCyclesPause)->Arg(0)->Arg(1000)->Iterations(200);
+BENCHMARK(BM_ConcurrentCopyRelease)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_ConcurrentAdoptRelease)->Arg(0)->Arg(256)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_ReleaseLargeGraph)->Arg(0)->Arg(1);
+BENCHMARK(BM_SumIndexed)->Arg(1 << 16);
+BENCHMARK(BM_SumIndexedUnchecked)->Arg(1 << 16);
+BENCHMARK(BM_SumIter)->Arg(1 << 16);
+BENCHMARK(BM_SumSpan)->Arg(1 << 16);
+BENCHMARK(BM_SumRawPointer)->Arg(1 << 16);
+BENCHMARK(BM_WeakLock);
+BENCHMARK(BM_WeakPtrLock);
+BENCHMARK(BM_VectorGrowPointer)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_VectorGrowSharedPtr)->RangeMultiplier(10)->Range(1000, 1000000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,74 @@
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <vector>
+#include "gc_pointer.h"
+// Replaces the global operator new and delete, it gets a program
+// of its own so benchmark.cpp keeps measuring the plain allocator.
+// Build with -DLEAK_PROFILE to measure the profiling as well.
+#include "LeakTester.h"
+
+// malloc and free, what LeakTester adds its bookkeeping to.
+static void BM_MallocFree(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        void* p = std::malloc(sizeof(int));
+        benchmark::DoNotOptimize(p);
+        std::free(p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// new and delete through LeakTester with n other allocations
+// live, the tracking map holds all of them.
+static void BM_TrackedNewDelete(benchmark::State& state)
+{
+    std::vector<int*> live;
+    live.reserve(state.range(0));
+    for (int64_t i = 0; i < state.range(0); i++)
+    {
+        live.push_back(new int(static_cast<int>(i)));
+    }
+    for (auto _ : state)
+    {
+        int* p = new int(1);
+        benchmark::DoNotOptimize(p);
+        delete p;
+    }
+    for (size_t i = 0; i < live.size(); i++)
+    {
+        delete live[i];
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Adopting an object allocated through LeakTester, control
+// blocks come from the pool and rarely reach operator new.
+static void BM_TrackedAdoptRelease(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        Pointer<int> p(new int(1));
+        benchmark::DoNotOptimize(&*p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Threads allocating at once, spread over the map's shards.
+static void BM_TrackedConcurrentNewDelete(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        int* p = new int(1);
+        benchmark::DoNotOptimize(p);
+        delete p;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_MallocFree);
+BENCHMARK(BM_TrackedNewDelete)->RangeMultiplier(100)->Range(1, 1000000);
+BENCHMARK(BM_TrackedAdoptRelease);
+BENCHMARK(BM_TrackedConcurrentNewDelete)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,336 @@
+#ifndef GC_BACKGROUND_H
+#define GC_BACKGROUND_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "gc_details.h"
+
+namespace gc {
+
+// Bounded lock-free queue for any number of producers and
+// consumers. Every cell carries a sequence number telling
+// whether it is free for the next push or the next pop.
+template <class T>
+class BoundedQueue
+{
+    public:
+        // capacity is rounded up to a power of two.
+        explicit BoundedQueue(size_t capacity);
+
+        // Returns false if the queue is full.
+        bool push(const T& value);
+        // Returns false if the queue is empty.
+        bool pop(T& value);
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence_;
+            T value_;
+        };
+
+        std::unique_ptr<Cell[]> cells_;
+        size_t mask_;
+        // Producers and the consumer update the positions, they get
+        // a cache line each. Padding instead of alignas, the queue is
+        // allocated with new and C++14 doesn't over-align that.
+        char pad0_[64];
+        std::atomic<size_t> push_pos_{0};
+        char pad1_[64 - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> pop_pos_{0};
+        char pad2_[64 - sizeof(std::atomic<size_t>)];
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+};
+
+template <class T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size *= 2;
+    }
+    cells_.reset(new Cell[size]);
+    mask_ = size - 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        cells_[i].sequence_.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <class T>
+bool BoundedQueue<T>::push(const T& value)
+{
+    size_t pos = push_pos_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Cell& cell = cells_[pos & mask_];
+        size_t sequence = cell.sequence_.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0)
+        {
+            if (push_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.value_ = value;
+                cell.sequence_.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = push_pos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template <class T>
+bool BoundedQueue<T>::pop(T& value)
+{
+    size_t pos = pop_pos_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Cell& cell = cells_[pos & mask_];
+        size_t sequence = cell.sequence_.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+        if (diff == 0)
+        {
+            if (pop_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                value = cell.value_;
+                cell.sequence_.store(pos + mask_ + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = pop_pos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Runs the destructors and deallocations of unreferenced objects
+// on a thread of its own, so dropping the last Pointer to a large
+// graph doesn't stall the releasing thread. Only ConcurrentPointers
+// use it, single threaded Pointers can't be freed on another thread.
+// Single threaded Pointers held by the objects it frees hand their
+// releases back to the thread using them, see on_collector_thread().
+// When the queue is full the releasing thread frees the object
+// itself, which slows producers down to what the collector keeps
+// up with.
+class BackgroundCollector
+{
+    public:
+        BackgroundCollector() = default;
+        ~BackgroundCollector()
+        {
+            stop();
+        }
+
+        // Start the collector thread with room for
+        // capacity queued objects. Does nothing if it runs.
+        void start(size_t capacity);
+        // Free everything queued and join the thread.
+        // Must not be called on the collector thread.
+        void stop();
+        // Wait until everything queued so far was freed.
+        // Must not be called on the collector thread.
+        void flush();
+
+        bool running() const
+        {
+            return running_.load();
+        }
+
+        // True on the collector thread. Destructors running there
+        // must leave the single threaded registry alone.
+        static bool on_collector_thread()
+        {
+            return collector_thread();
+        }
+
+        // Queue an unlinked control block for destruction. Returns
+        // false if the collector isn't running or the queue is full,
+        // the caller destroys the block then.
+        bool push(ControlBlock* block);
+
+    private:
+        std::unique_ptr<BoundedQueue<ControlBlock*> > queue_;
+        std::thread thread_;
+        std::atomic<bool> running_{false};
+        // Threads inside push(), stop() waits for them so nothing
+        // is queued after the collector thread drained the queue.
+        std::atomic<size_t> producers_{0};
+        std::atomic<size_t> queued_{0};
+        std::atomic<size_t> freed_{0};
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable freed_cond_;
+        // Serializes start() and stop().
+        std::mutex control_mutex_;
+
+        static bool& collector_thread()
+        {
+            thread_local bool flag = false;
+            return flag;
+        }
+        void run();
+        // Destroy everything in the queue. Returns true if
+        // there was anything.
+        bool drain();
+
+        BackgroundCollector(const BackgroundCollector&) = delete;
+        BackgroundCollector& operator=(const BackgroundCollector&) = delete;
+};
+
+inline void BackgroundCollector::start(size_t capacity)
+{
+    std::lock_guard<std::mutex> control(control_mutex_);
+    if (running_.load())
+    {
+        return;
+    }
+    queue_.reset(new BoundedQueue<ControlBlock*>(capacity));
+    running_.store(true);
+    thread_ = std::thread(&BackgroundCollector::run, this);
+}
+
+inline void BackgroundCollector::stop()
+{
+    std::lock_guard<std::mutex> control(control_mutex_);
+    if (!running_.load())
+    {
+        return;
+    }
+    running_.store(false);
+    while (producers_.load() != 0)
+    {
+        std::this_thread::yield();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_.notify_one();
+    }
+    thread_.join();
+    queue_.reset();
+}
+
+inline void BackgroundCollector::flush()
+{
+    if (!running_.load())
+    {
+        return;
+    }
+    size_t target = queued_.load();
+    std::unique_lock<std::mutex> lock(mutex_);
+    wake_.notify_one();
+    freed_cond_.wait(lock, [this, target]() { return freed_.load() >= target; });
+}
+
+inline bool BackgroundCollector::push(ControlBlock* block)
+{
+    producers_.fetch_add(1);
+    bool queued = running_.load() && queue_->push(block);
+    if (queued)
+    {
+        queued_.fetch_add(1);
+    }
+    producers_.fetch_sub(1);
+    return queued;
+}
+
+inline bool BackgroundCollector::drain()
+{
+    ControlBlock* block;
+    bool any = false;
+    while (queue_->pop(block))
+    {
+        // Destructors may release further Pointers, their
+        // objects go through push() like any other.
+        block->type_->destroy(block);
+        freed_.fetch_add(1);
+        any = true;
+    }
+    return any;
+}
+
+inline void BackgroundCollector::run()
+{
+    // Producers don't signal every push, an idle collector
+    // looks at the queue again after this long.
+    const std::chrono::milliseconds idle_wait(1);
+    collector_thread() = true;
+    for (;;)
+    {
+        bool any = drain();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            freed_cond_.notify_all();
+        }
+        if (!running_.load() && (producers_.load() == 0))
+        {
+            // Objects destroyed by the last drain may have
+            // queued more before running_ was cleared.
+            if (!drain())
+            {
+                break;
+            }
+            continue;
+        }
+        if (!any)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait_for(lock, idle_wait);
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    freed_cond_.notify_all();
+}
+
+// The collector shared by every ConcurrentPointer.
+inline BackgroundCollector& background_collector()
+{
+    static BackgroundCollector collector;
+    return collector;
+}
+
+// Free unreferenced ConcurrentPointer objects on a background
+// thread, with room for capacity objects waiting to be freed.
+// Objects may hold single threaded Pointers: their releases are
+// handed back and applied by the next single threaded release or
+// collection, until then their targets stay alive. Single threaded
+// WeakPointers must not be held by such objects.
+inline void start_background_collector(size_t capacity = 4096)
+{
+    background_collector().start(capacity);
+}
+
+// Free what is still queued and stop the thread.
+inline void stop_background_collector()
+{
+    background_collector().stop();
+}
+
+// Wait until objects released so far were freed.
+inline void flush_background_collector()
+{
+    background_collector().flush();
+}
+
+} // namespace gc
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef GC_COLLECTOR_H
+#define GC_COLLECTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace gc {
+
+// Decides when memory whose reference count dropped
+// to zero is actually released.
+enum class CollectPolicy
+{
+    Immediate,  // free as soon as the last Pointer lets go
+    Threshold,  // batch garbage until a byte or object limit is hit
+    Explicit    // never free on release, only when collect() is called
+};
+
+// How the registries are torn down when the program exits,
+// see gc::set_shutdown_mode().
+enum class ShutdownMode
+{
+    Free,      // destroy every object, one pass over the registry
+    Parallel,  // the same, ConcurrentPointer objects on several threads
+    Skip       // destroy nothing, the operating system takes the memory back
+};
+
+// What a collect hook is told about.
+enum class CollectKind
+{
+    Full,         // collect()
+    Incremental,  // collect_incremental()
+    Cycles,       // collect_cycles() on its own, or one of its steps
+    Young         // a full nursery, see gc::set_nursery_size()
+};
+
+// Passed to the collect hooks. result and pause are only
+// filled in for the hook that runs after the collection.
+struct CollectEvent;
+using CollectHook = void (*)(const CollectEvent& event);
+
+// Called when the managed heap outgrew its budget, before the
+// collection that follows. Dropping Pointers held by caches here
+// lets that collection free them.
+using PressureHandler = void (*)(size_t live_bytes, size_t budget);
+
+// Runtime collector settings shared by every Pointer type.
+// Fields are atomic so they can be changed while other
+// threads release Pointers.
+struct CollectorConfig
+{
+    std::atomic<CollectPolicy> policy{CollectPolicy::Immediate};
+    // Threshold mode runs a collection once either limit is reached.
+    std::atomic<size_t> threshold_bytes{1 << 20};
+    std::atomic<size_t> threshold_objects{1024};
+    // collect() also looks for unreachable cycles of types
+    // that specialize gc::Children.
+    std::atomic<bool> trace_cycles{false};
+    // When set, the Threshold policy runs an incremental step of
+    // this many entries instead of a full collect().
+    std::atomic<size_t> step_entries{0};
+    std::atomic<int64_t> step_micros{0};
+    // Live bytes each registry may hold before it calls the
+    // pressure handler and collects, 0 for no limit.
+    std::atomic<size_t> heap_budget{0};
+    std::atomic<PressureHandler> pressure_handler{nullptr};
+    // Objects built by make() the nursery of each registry holds
+    // before it is swept, 0 to enter them in the registry directly.
+    std::atomic<size_t> nursery_size{0};
+    std::atomic<CollectHook> collect_begin{nullptr};
+    std::atomic<CollectHook> collect_end{nullptr};
+    // Count reference count changes for gc::stats(), costs
+    // a shared counter update on every copy and release.
+    std::atomic<bool> count_ref_ops{false};
+    std::atomic<ShutdownMode> shutdown_mode{ShutdownMode::Free};
+    // Threads of the Parallel mode, 0 for one per core.
+    std::atomic<size_t> shutdown_threads{0};
+};
+
+// Limits how much work one collect_incremental() or
+// collect_cycles_incremental() call does. A zero field
+// doesn't limit anything.
+struct CollectBudget
+{
+    size_t entries = 0;
+    std::chrono::microseconds time{0};
+};
+
+// What a collection released. Converts to true if at
+// least one object was freed.
+struct CollectResult
+{
+    size_t objects = 0;
+    size_t bytes = 0;
+    // The collection reached the end of the registry, an incremental
+    // one starts from the beginning again on the next call.
+    bool completed_pass = false;
+
+    explicit operator bool() const
+    {
+        return objects != 0;
+    }
+
+    CollectResult& operator+=(const CollectResult& rhs)
+    {
+        objects += rhs.objects;
+        bytes += rhs.bytes;
+        completed_pass = completed_pass && rhs.completed_pass;
+        return *this;
+    }
+};
+
+struct CollectEvent
+{
+    CollectKind kind;
+    // Collected ConcurrentPointer objects rather than Pointer ones.
+    bool concurrent;
+    CollectResult result;
+    std::chrono::nanoseconds pause;
+};
+
+// Snapshot of the collector, see gc::stats().
+struct Stats
+{
+    size_t live_objects = 0;
+    // Counting control blocks, as the heap budget does.
+    size_t live_bytes = 0;
+    // Objects freed in any way, on release as well as by collections.
+    size_t objects_freed = 0;
+    // collect(), collect_incremental() and collect_cycles() calls
+    // and nursery sweeps, and the time they took.
+    size_t collections = 0;
+    std::chrono::nanoseconds total_pause{0};
+    std::chrono::nanoseconds max_pause{0};
+    // Published registry entries, and how many of them a lookup
+    // compares with on average and at most.
+    size_t registry_entries = 0;
+    double mean_probe_length = 0;
+    size_t max_probe_length = 0;
+    // Objects still in the nursery, not counted as registry entries.
+    size_t nursery_entries = 0;
+    // Reference count increments and decrements, only counted after
+    // gc::set_count_ref_ops(true). The rate is over the time since
+    // the previous gc::stats() call.
+    size_t ref_ops = 0;
+    double ref_ops_per_second = 0;
+};
+
+inline CollectorConfig& collector_config()
+{
+    static CollectorConfig config;
+    return config;
+}
+
+inline CollectPolicy collect_policy()
+{
+    return collector_config().policy.load(std::memory_order_relaxed);
+}
+
+// Switching away from a deferred policy doesn't release garbage
+// that is already pending, call Pointer<T>::collect() for that.
+inline void set_collect_policy(CollectPolicy policy)
+{
+    collector_config().policy.store(policy);
+}
+
+inline void set_collect_threshold(size_t bytes, size_t objects)
+{
+    collector_config().threshold_bytes.store(bytes);
+    collector_config().threshold_objects.store(objects);
+}
+
+// Let the Threshold policy do bounded incremental steps instead
+// of full collections, so releasing a Pointer never walks the whole
+// registry. With gc::set_trace_cycles() on, every step is followed
+// by a cycle step within the same budget. An empty budget switches
+// back to full collections.
+inline void set_collect_step(const CollectBudget& budget)
+{
+    collector_config().step_entries.store(budget.entries);
+    collector_config().step_micros.store(budget.time.count());
+}
+
+// Collect whenever the objects of one threading policy take more
+// than bytes, counting their control blocks. handler, if given,
+// runs first so caches can let go of what they hold. A budget of 0
+// turns the limit off.
+inline void set_heap_budget(size_t bytes, PressureHandler handler = nullptr)
+{
+    collector_config().pressure_handler.store(handler);
+    collector_config().heap_budget.store(bytes);
+}
+
+// Keep objects built by make() in a nursery, a list per registry
+// shard that is swept once it holds entries objects in total. The
+// dead are freed without ever being hashed into the registry, the
+// survivors move there. Pays off under the Threshold policy when
+// most objects die young; keep it below the object limit, otherwise
+// full collections come first. Immediate frees on release and
+// doesn't use the nursery. Under Explicit a full nursery frees
+// nothing, the dead move to the registry with the survivors and
+// wait for collect(). 0 turns it off.
+inline void set_nursery_size(size_t entries)
+{
+    collector_config().nursery_size.store(entries);
+}
+
+// Call begin and end around every collection, on the thread that
+// runs it. Either may be nullptr. Hooks must not collect themselves.
+inline void set_collect_hooks(CollectHook begin, CollectHook end)
+{
+    collector_config().collect_begin.store(begin);
+    collector_config().collect_end.store(end);
+}
+
+// Pick how the registries are torn down at exit, explicit
+// shutdown() calls always free in one pass. Parallel splits the
+// shards of ConcurrentPointers over threads, their objects must
+// then be safe to destroy on any thread; single threaded objects
+// are freed first. Skip is std::quick_exit() for the managed heap:
+// no destructor runs, buffers they would flush are lost and a leak
+// checker reports every object.
+inline void set_shutdown_mode(ShutdownMode mode, size_t threads = 0)
+{
+    collector_config().shutdown_threads.store(threads);
+    collector_config().shutdown_mode.store(mode);
+}
+
+inline void set_count_ref_ops(bool enabled)
+{
+    collector_config().count_ref_ops.store(enabled);
+}
+
+// Cycle tracing walks every live object of a traced type, it is
+// off by default. Pointer<T>::collect_cycles() runs it on demand,
+// collect_cycles_incremental() a part of it at a time.
+inline void set_trace_cycles(bool enabled)
+{
+    collector_config().trace_cycles.store(enabled);
+}
+
+} // namespace gc
+
+#endif
@@ -1,30 +1,89 @@
+#ifndef GC_DETAILS_H
+#define GC_DETAILS_H
+
+#include <atomic>
+#include <cstddef>
+#include <typeinfo>
+
+namespace gc {
+
+class ControlBlock;
+class Tracer;
+
+// What the registry needs to know about the objects behind a
+// control block. There is one table per Pointer type, so the
+// registry can hold every type at once.
+struct ManagedType
+{
+    // Destroy the object together with its control block.
+    void (*destroy)(ControlBlock* block);
+    // Hand the Pointers held by the object to tracer, nullptr
+    // for types that don't specialize gc::Children.
+    void (*trace)(ControlBlock* block, Tracer& tracer);
+    size_t element_size;
+    // Named in heap dumps, see gc::dump_heap().
+    const std::type_info* info;
+    // The memory a block manages, its key in the registry.
+    const void* (*address)(const ControlBlock* block);
+};
+
+// The part of a control block that doesn't depend on the
+// type of the managed memory.
+// The reference count is atomic so the same control block works
+// for single and multi threaded Pointers, the threading policy
+// picks how it is updated.
+class ControlBlock
+{
+    public:
+        std::atomic<size_t> ref_count_{0};
+        // WeakPointers to this block, plus one until the object is
+        // destroyed. The block outlives the object until it drops to 0.
+        std::atomic<size_t> weak_count_{1};
+        size_t array_size_ = 0;
+        // Thread cache that registered this block and hasn't
+        // published it to the shared registry yet.
+        std::atomic<const void*> owner_{nullptr};
+        const ManagedType* type_ = nullptr;
+        bool is_array_ = false;
+        // The object was built by make_gc() right behind this
+        // block, both go away with a single deallocation.
+        bool inline_ = false;
+
+        // Bytes of managed memory behind this block.
+        size_t bytes() const
+        {
+            return type_->element_size * (is_array_ ? array_size_ : 1);
+        }
+
+    protected:
+        ControlBlock() = default;
+        ~ControlBlock() = default;
+
+    private:
+        ControlBlock(const ControlBlock&) = delete;
+        ControlBlock& operator=(const ControlBlock&) = delete;
+};
+
+} // namespace gc
+
 // This class defines an element that is stored
 // in the garbage collection information list.
 //
 template <class T>
-class PtrDetails
+class PtrDetails : public gc::ControlBlock
 {
     public:
-        size_t ref_count_ = 0;
         T *mem_ptr_ = nullptr;
-        bool is_array_ = false; 
-        size_t array_size_ = 0;
     
-        explicit PtrDetails(T* obj_ptr, size_t arr_size = 0) noexcept : mem_ptr_(obj_ptr), array_size_(arr_size)
+        PtrDetails(T* obj_ptr, const gc::ManagedType* type, bool is_array, size_t arr_size) noexcept
         {
-            is_array_ = (arr_size > 0);
-            ref_count_++;
+            mem_ptr_ = obj_ptr;
+            type_ = type;
+            array_size_ = arr_size;
+            is_array_ = is_array;
+            ref_count_.store(1, std::memory_order_relaxed);
         }
-
-    private:
-        PtrDetails(const PtrDetails&) = delete;
-        PtrDetails& operator=(const PtrDetails&) = delete;
     
 };
 
-// This is needed by the STL list class.
-template <class T>
-bool operator==(const PtrDetails<T> &ob1, const PtrDetails<T> &ob2)
-{
-    return (ob1.mem_ptr_ == ob2.mem_ptr_); 
-}
\ No newline at end of file
+#endif
@@ -0,0 +1,202 @@
+#ifndef GC_DUMP_H
+#define GC_DUMP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "gc_collector.h"
+#include "gc_details.h"
+#include "gc_registry.h"
+#include "gc_threading.h"
+#include "gc_trace.h"
+
+/*
+    Heap snapshots for offline analysis. gc::dump_heap()
+    writes every registered object of both registries to a
+    binary file: a DumpHeader, then header.types DumpType
+    records each followed by name_length bytes of the
+    type's mangled name, then header.objects DumpObject
+    and header.edges DumpEdge records. All fields are
+    fixed width in the byte order of the host, which the
+    magic shows: it reads "GCHEAP" followed by the
+    version in the host's order. Records have no padding,
+    the reserved fields that align them are written as 0.
+    A DumpHeader is 40 bytes: magic at offset 0, version
+    at 6, flags at 8, reserved at 12, then types, objects
+    and edges at 16, 24 and 32.
+
+    The registry is copied one shard at a time under that
+    shard's lock, the file is written once every lock is
+    released again. Objects still buffered in other
+    threads' caches and intrusive objects aren't in it.
+*/
+
+namespace gc {
+
+const uint16_t dump_version = 1;
+
+struct DumpHeader
+{
+    char magic[6];
+    uint16_t version;
+    // DumpHeader::has_edges if reference edges follow.
+    uint32_t flags;
+    uint32_t reserved = 0;
+    uint64_t types;
+    uint64_t objects;
+    uint64_t edges;
+
+    static const uint32_t has_edges = 1;
+};
+
+struct DumpType
+{
+    uint64_t id;
+    uint64_t element_size;
+    uint64_t name_length;
+};
+
+struct DumpObject
+{
+    // Identifies the object in edges.
+    uint64_t block;
+    uint64_t address;
+    // DumpType::id
+    uint64_t type;
+    uint64_t bytes;
+    uint64_t ref_count;
+    // WeakPointers, plus one while the object lives.
+    uint64_t weak_count;
+    uint64_t array_size;
+    uint32_t flags;
+    uint32_t reserved;
+
+    static const uint32_t array = 1;
+    // Built by make_gc(), object and control block share a chunk.
+    static const uint32_t inline_block = 2;
+    // Managed by ConcurrentPointers.
+    static const uint32_t concurrent = 4;
+};
+
+// A Pointer inside the object of from refers to that of to,
+// as told by gc::Children.
+struct DumpEdge
+{
+    uint64_t from;
+    uint64_t to;
+};
+
+// What dump_heap() copies out of the registries.
+struct HeapSnapshot
+{
+    std::vector<const ManagedType*> types;
+    std::unordered_map<const ManagedType*, uint64_t> type_ids;
+    std::vector<DumpObject> objects;
+    std::vector<DumpEdge> edges;
+};
+
+struct EdgeTracer final : Tracer
+{
+    std::vector<DumpEdge>& edges_;
+    uint64_t from_ = 0;
+
+    explicit EdgeTracer(std::vector<DumpEdge>& edges) : edges_(edges) {}
+
+    bool visit(ControlBlock* child) override
+    {
+        edges_.push_back({from_, reinterpret_cast<uintptr_t>(child)});
+        return false;
+    }
+};
+
+template <class Threading>
+void snapshot_registry(HeapSnapshot& snapshot, bool edges)
+{
+    const uint32_t concurrent = std::is_same<Threading, MultiThreaded>::value ? DumpObject::concurrent : 0;
+    EdgeTracer tracer(snapshot.edges);
+    registry<Threading>().for_each([&](const void* key, ControlBlock* block)
+    {
+        std::unordered_map<const ManagedType*, uint64_t>::iterator type = snapshot.type_ids.find(block->type_);
+        if (type == snapshot.type_ids.end())
+        {
+            type = snapshot.type_ids.emplace(block->type_, snapshot.types.size()).first;
+            snapshot.types.push_back(block->type_);
+        }
+
+        DumpObject object;
+        object.block = reinterpret_cast<uintptr_t>(block);
+        object.address = reinterpret_cast<uintptr_t>(key);
+        object.type = type->second;
+        object.bytes = block->bytes();
+        object.ref_count = block->ref_count_.load(std::memory_order_relaxed);
+        object.weak_count = block->weak_count_.load(std::memory_order_relaxed);
+        object.array_size = block->array_size_;
+        object.flags = (block->is_array_ ? DumpObject::array : 0) |
+                       (block->inline_ ? DumpObject::inline_block : 0) | concurrent;
+        object.reserved = 0;
+        snapshot.objects.push_back(object);
+
+        if (edges && (block->type_->trace != nullptr))
+        {
+            tracer.from_ = object.block;
+            block->type_->trace(block, tracer);
+        }
+    });
+}
+
+template <class Record>
+bool write_records(std::FILE* file, const std::vector<Record>& records)
+{
+    return records.empty() || (std::fwrite(records.data(), sizeof(Record), records.size(), file) == records.size());
+}
+
+// Write a snapshot of the managed heap to file. Edges are traced
+// through gc::Children like collect_cycles() does, which reads the
+// Pointers inside objects: ConcurrentPointers held by traced objects
+// must not change on other threads meanwhile. Returns false if
+// writing failed.
+inline bool dump_heap(std::FILE* file, bool edges)
+{
+    HeapSnapshot snapshot;
+    snapshot_registry<SingleThreaded>(snapshot, edges);
+    snapshot_registry<MultiThreaded>(snapshot, edges);
+
+    DumpHeader header;
+    std::memcpy(header.magic, "GCHEAP", sizeof(header.magic));
+    header.version = dump_version;
+    header.flags = edges ? DumpHeader::has_edges : 0;
+    header.types = snapshot.types.size();
+    header.objects = snapshot.objects.size();
+    header.edges = snapshot.edges.size();
+    bool written = (std::fwrite(&header, sizeof(header), 1, file) == 1);
+
+    for (size_t i = 0; written && (i < snapshot.types.size()); i++)
+    {
+        const char* name = snapshot.types[i]->info->name();
+        DumpType type = {i, snapshot.types[i]->element_size, std::strlen(name)};
+        written = (std::fwrite(&type, sizeof(type), 1, file) == 1) &&
+                  (std::fwrite(name, 1, type.name_length, file) == type.name_length);
+    }
+    written = written && write_records(file, snapshot.objects) && write_records(file, snapshot.edges);
+    return (std::fflush(file) == 0) && written;
+}
+
+// Same as above into the file at path, with edges if
+// gc::set_trace_cycles() turned tracing on.
+inline bool dump_heap(const char* path)
+{
+    std::FILE* file = std::fopen(path, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool written = dump_heap(file, collector_config().trace_cycles.load(std::memory_order_relaxed));
+    return (std::fclose(file) == 0) && written;
+}
+
+} // namespace gc
+
+#endif
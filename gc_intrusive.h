@@ -0,0 +1,62 @@
+#ifndef GC_INTRUSIVE_H
+#define GC_INTRUSIVE_H
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+namespace gc {
+
+// Base for types that keep their own reference count. Pointers to
+// them skip the control block and the registry, copying and releasing
+// one is a single update of the count inside the object:
+//
+//     struct Particle : gc::IntrusiveBase
+//     {
+//         float x, y;
+//     };
+//
+//     Pointer<Particle> p = make_gc<Particle>();
+//
+// The object is deleted as soon as the last Pointer lets go, no
+// matter the collect policy. Such objects never show up in collect(),
+// collect_cycles() or gc::stats(), so cycles through them are never
+// freed, and they can't be arrays or be held by WeakPointers.
+class IntrusiveBase
+{
+    protected:
+        IntrusiveBase() noexcept = default;
+        // A copy is a new object, nobody refers to it yet.
+        IntrusiveBase(const IntrusiveBase&) noexcept
+        {
+        }
+        IntrusiveBase& operator=(const IntrusiveBase&) noexcept
+        {
+            return *this;
+        }
+        ~IntrusiveBase() = default;
+
+    private:
+        friend struct IntrusiveAccess;
+
+        mutable std::atomic<size_t> gc_ref_count_{0};
+};
+
+// Lets Pointer reach the count without making it public.
+struct IntrusiveAccess
+{
+    static std::atomic<size_t>& count(const IntrusiveBase* object)
+    {
+        return object->gc_ref_count_;
+    }
+};
+
+// True for types that derive from IntrusiveBase. Only looked at
+// inside Pointer's member functions, where T is complete, so a type
+// may hold Pointers to itself.
+template <class T>
+using IsIntrusive = std::integral_constant<bool, std::is_base_of<IntrusiveBase, T>::value>;
+
+} // namespace gc
+
+#endif
@@ -1,3 +1,8 @@
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include "gc_policy.h"
+
 // Exception thrown when an attempt is made to
 // use an Iter that exceeds the range of the
 // underlying object.
@@ -13,8 +18,13 @@ class OutOfRangeExc
 // collection. Thus, an Iter pointing to
 // some object does not prevent that object
 // from being recycled.
+// Iter is a random access iterator, dereferencing
+// is bounds checked unless checked is false, as
+// for Pointers with the gc::Unchecked policy, or
+// the build defines GC_UNCHECKED.
+// Pointer::span() gives unchecked access too.
 
-template <class T>
+template <class T, bool checked = gc::DefaultChecking::checked>
 class Iter
 {
    private: 
@@ -25,15 +35,21 @@ class Iter
         size_t length_;      
   
     public:   
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T*;
+        using reference = T&;
+
         Iter()
         {
             ptr_ = nullptr;
             end_ = nullptr;
-            begin_ = NULL;
+            begin_ = nullptr;
             length_ = 0;
         }
 
-        Iter(const T *p, const T *first, const T *last)
+        Iter(T *p, T *first, T *last)
         {
             ptr_ = p;
             end_ = last;
@@ -43,16 +59,16 @@ class Iter
 
         // Return length of sequence to which this
         // Iter points.
-        size_t size() 
+        size_t size() const
         {    
             return length_;
         }
     
         // Return value pointed to by ptr.
         // Do not allow out-of-bounds access.
-        T &operator*()
+        T &operator*() const
         {
-            if ((ptr_ >= end_) || (ptr_ < begin_))
+            if (checked && ((ptr_ >= end_) || (ptr_ < begin_)))
             {
                 throw std::out_of_range("Invalid access");
             }
@@ -61,9 +77,9 @@ class Iter
 
         // Return address contained in ptr.
         // Do not allow out-of-bounds access.
-        T* operator->()
+        T* operator->() const
         {
-            if ((ptr_ >= end_) || (ptr_ < begin_))
+            if (checked && ((ptr_ >= end_) || (ptr_ < begin_)))
             {
                 throw std::out_of_range("Invalid access");
             }       
@@ -71,78 +87,113 @@ class Iter
         }
 
         // Prefix ++.
-        Iter operator++()
+        Iter& operator++()
         {
             ptr_++;
             return *this;
         }
 
         // Prefix --.
-        Iter operator--()
+        Iter& operator--()
         {
             ptr_--;
             return *this;
         }
 
+        // Postfix ++.
+        Iter operator++(int)
+        {
+            Iter tmp = *this;
+            ptr_++;
+            return tmp;
+        }
+
+        // Postfix --.
+        Iter operator--(int)
+        {
+            Iter tmp = *this;
+            ptr_--;
+            return tmp;
+        }
+
         // Return a reference to the object at the
-        // specified index. Do not allow out-of-bounds
-        // access.
-        T& operator[](size_t i)
+        // specified offset from this Iter. Do not allow
+        // out-of-bounds access.
+        T& operator[](difference_type i) const
         {
-            if ((i < 0) || (i >= (end_ - begin_)))
+            if (checked && (((ptr_ + i) < begin_) || ((ptr_ + i) >= end_)))
             {
-                std::out_of_range("Invalid access");
+                throw std::out_of_range("Invalid access");
             }         
             return ptr_[i];
         }
 
         // Define the relational operators.
-        bool operator==(const Iter& op2)
+        bool operator==(const Iter& op2) const
         {
             return ptr_ == op2.ptr_;
         }
 
-        bool operator!=(const Iter<T>& op2)
+        bool operator!=(const Iter& op2) const
         {
             return ptr_ != op2.ptr_;
         }
 
-        bool operator<(const Iter<T>& op2)
+        bool operator<(const Iter& op2) const
         {
             return ptr_ < op2.ptr_;
         }
 
-        bool operator<=(const Iter<T>& op2)
+        bool operator<=(const Iter& op2) const
         {
             return ptr_ <= op2.ptr_;
         }
 
-        bool operator>(const Iter<T>& op2)
+        bool operator>(const Iter& op2) const
         {
             return ptr_ > op2.ptr_;
         }
 
-        bool operator>=(const Iter<T>& op2)
+        bool operator>=(const Iter& op2) const
         {   
             return ptr_ >= op2.ptr_;
         }
 
-        // Subtract an integer from an Iter.
-        Iter operator-(int n)
+        Iter& operator+=(difference_type n)
+        {
+            ptr_ += n;
+            return *this;
+        }
+
+        Iter& operator-=(difference_type n)
         {
             ptr_ -= n;
             return *this;
+        }
+
+        // Subtract an integer from an Iter.
+        Iter operator-(difference_type n) const
+        {
+            Iter tmp = *this;
+            tmp.ptr_ -= n;
+            return tmp;
         }   
 
         // Add an integer to an Iter.
-        Iter operator+(int n)
+        Iter operator+(difference_type n) const
         {
-            ptr_ += n;
-            return *this;
+            Iter tmp = *this;
+            tmp.ptr_ += n;
+            return tmp;
+        }
+
+        friend Iter operator+(difference_type n, const Iter& itr)
+        {
+            return itr + n;
         }
 
         // Return number of elements between two Iters.
-        int operator-(const Iter<T>& itr2)
+        difference_type operator-(const Iter& itr2) const
         {
             return ptr_ - itr2.ptr_;
         }
@@ -1,11 +1,30 @@
+#ifndef GC_POINTER_H
+#define GC_POINTER_H
+
 #include <iostream>
-#include <list>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <new>
 #include <typeinfo>
+#include <type_traits>
+#include <cstdint>
 #include <cstdlib>
 #include <stdexcept>
 #include <cassert>
+#include "gc_collector.h"
 #include "gc_details.h"
+#include "gc_intrusive.h"
 #include "gc_iterator.h"
+#include "gc_policy.h"
+#include "gc_pool.h"
+#include "gc_registry.h"
+#include "gc_span.h"
+#include "gc_threading.h"
+#include "gc_trace.h"
 
 /*
     Pointer implements a pointer type that uses
@@ -13,61 +32,281 @@
     A Pointer must only be used to point to memory
     that was dynamically allocated using new.
     When used to refer to an allocated array,
-    specify the array size.
+    specify the array size, or use Pointer<T[]>
+    for arrays whose length is only known at
+    run time.
+    make_gc() and make_gc_array() build the object
+    and its control block in one pooled allocation,
+    prefer them over adopting memory from new.
+    The Threading policy decides whether Pointers
+    of this type may be shared between threads,
+    see ConcurrentPointer below. A gc::Policy in
+    its place also fixes the collect policy and
+    bounds checking at compile time.
+    Reference counting can't free cycles, types
+    that specialize gc::Children get them freed
+    by collect_cycles().
+    Every Pointer type with the same Threading
+    policy shares one registry, see gc_registry.h.
+    Types deriving from gc::IntrusiveBase count
+    their references themselves and bypass it.
 */
 
-template <class T, int size = 0>
+namespace gc {
+
+// Pointer size of arrays that store their length at run time,
+// all lengths share one Pointer type. Pointer<T[]> uses it.
+const int dynamic_size = -1;
+
+// How the registry destroys and traces the objects of
+// Pointer<T, size, Threading>. Keyed on the bare threading
+// policy, so Pointers that only differ in their other
+// policies share the table and can share objects.
+template <class T, int size, class Threading>
+struct PointerType
+{
+    static const ManagedType value;
+};
+
+} // namespace gc
+
+template <class T, int size, class Threading>
+class WeakPointer;
+
+template <class T, int size = 0, class Threading = gc::SingleThreaded>
 class Pointer
 {
 
 private:
-    // refContainer maintains the garbage collection list.
-    static std::list<PtrDetails<T> > sRefContainer;
-    static bool sFirst;         // true when first Pointer is created
-    
+    // Pointers of other types clear children directly while
+    // cycles are freed.
+    template <class U, int other_size, class OtherThreading>
+    friend class Pointer;
+    friend class WeakPointer<T, size, Threading>;
+    template <class U, int other_size, class OtherThreading>
+    friend struct gc::PointerType;
+
+    using Policies = gc::PolicyTraits<Threading>;
+    using Registry = gc::Registry<typename Policies::threading>;
+    // refContainer maintains the garbage collection registry,
+    // keyed by the address of the managed memory so lookups
+    // don't have to walk every live allocation. Control blocks
+    // live outside of it so they can move between registries.
+    using RefContainer = typename Registry::RefContainer;
+    using Shard = typename Registry::Shard;
+    using Lock = typename Registry::Lock;
+    using ThreadCache = typename Registry::ThreadCache;
+    // How the registry destroys and traces objects of this type,
+    // the same table for every collection and checking policy.
+    static const gc::ManagedType& sType;
+
     // addr points to the allocated memory to which
     // this Pointer pointer currently points.
     T* addr_ = nullptr;
     bool is_array_ = false;
-    size_t array_size_ = size;     // size of the array
-        
+    size_t array_size_ = (size > 0) ? size : 0;     // size of the array
+    // Control block of addr_ inside refContainer. Map nodes never
+    // move, so copies and releases can use it without a lookup.
+    PtrDetails<T>* details_ = nullptr;
+
+    static Registry& registry()
+    {
+        return gc::registry<typename Policies::threading>();
+    }
     // Return an iterator to pointer details in refContainer.
-    typename std::list<PtrDetails<T> >::iterator find_ptr_info(const T* ptr);
+    // The shard lock must be held.
+    static typename RefContainer::iterator find_ptr_info(Shard& shard, const T* ptr);
     void increment_or_add_to_ptr_list();
     void increment_ptr_list();
+    // Reference counting of gc::IntrusiveBase objects, no
+    // control block involved. The false_type overloads are
+    // never reached, they keep the other branch compiling.
+    static void intrusive_acquire(T* mem, std::true_type);
+    static void intrusive_acquire(T*, std::false_type)
+    {
+    }
+    static void intrusive_release(T* mem, std::true_type);
+    static void intrusive_release(T*, std::false_type)
+    {
+    }
+    // A Pointer with gc::dynamic_size adopting memory by address
+    // alone takes the length the registry recorded.
+    bool matches_length(const gc::ControlBlock* block) const
+    {
+        return (size == gc::dynamic_size) || (block->array_size_ == array_size_);
+    }
+    // Memory that isn't managed yet can only be adopted by
+    // a Pointer that knows its length.
+    static const size_t sUnknownLength = static_cast<size_t>(-1);
+    bool knows_length() const
+    {
+        return array_size_ != sUnknownLength;
+    }
+    // Drop the memory this Pointer failed to adopt and throw
+    // std::invalid_argument. The memory is left alone, a lookup
+    // misses on interior pointers and on memory managed by the
+    // other registry or another thread's cache as well.
+    void reject_unknown_length();
+    // Drop this Pointer's reference and, depending on the
+    // collect policy, free the memory once nobody refers to it.
+    void release();
+    static void free_memory(T* mem, bool is_array);
+    // Free the memory behind an unlinked control block
+    // together with the block itself, unless WeakPointers
+    // still use the block.
+    static void destroy(PtrDetails<T>* details);
+    // Drop one weak reference, the last one frees the block.
+    static void release_block(PtrDetails<T>* details);
+    static void destroy_block(gc::ControlBlock* block)
+    {
+        destroy(static_cast<PtrDetails<T>*>(block));
+    }
+    static const void* block_address(const gc::ControlBlock* block)
+    {
+        return static_cast<const PtrDetails<T>*>(block)->mem_ptr_;
+    }
+    static PtrDetails<T>* make_details(T* mem, bool is_array, size_t arr_size);
+    // What make() builds, a pooled chunk or an intrusive object.
+    template <class... Args>
+    static Pointer make_object(std::false_type, Args&&... args);
+    template <class... Args>
+    static Pointer make_object(std::true_type, Args&&... args);
+    static void recycle_details(PtrDetails<T>* details);
+    // Enter a control block that was built by make(),
+    // the memory can't be managed anywhere else yet.
+    static void register_details(PtrDetails<T>* details);
+    static gc::SizeClassPool<typename Policies::threading>& pool()
+    {
+        return gc::size_class_pool<typename Policies::threading>();
+    }
+    // Where make() puts the object behind its control block.
+    static size_t payload_offset()
+    {
+        return (sizeof(PtrDetails<T>) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+    // Chunks are only aligned to the pool's alignment, types aligned
+    // to more need room to move the object up to their alignment.
+    static size_t payload_slack()
+    {
+        const size_t chunk_alignment = gc::SizeClassPool<typename Policies::threading>::alignment;
+        return (alignof(T) > chunk_alignment) ? alignof(T) - chunk_alignment : 0;
+    }
+    static T* payload(void* chunk)
+    {
+        uintptr_t address = reinterpret_cast<uintptr_t>(chunk) + payload_offset();
+        return reinterpret_cast<T*>((address + alignof(T) - 1) / alignof(T) * alignof(T));
+    }
+    // Size of the chunk make() takes from the pool for count objects.
+    static size_t chunk_size(size_t count)
+    {
+        return payload_offset() + payload_slack() + sizeof(T) * count;
+    }
+    // Build the object, or the length array elements, for make().
+    template <class... Args>
+    static void construct(T* mem, size_t length, std::false_type, Args&&... args);
+    static void construct(T* mem, size_t length, std::true_type);
+    // Shared by make() and make_array().
+    template <class... Args>
+    static Pointer make_chunk(size_t length, Args&&... args);
+    // Take over the reference held by a fresh control block.
+    struct FromDetails {};
+    Pointer(PtrDetails<T>* details, FromDetails) noexcept;
+    // Passes the Pointers held by an object to the tracer,
+    // as reported by gc::Children<T>.
+    struct ChildVisitor
+    {
+        gc::Tracer& tracer_;
 
-    // Helper iterator variables
-    typename std::list<PtrDetails<T> >::iterator it_end_of_ptr_list_;
-    typename std::list<PtrDetails<T> >::iterator it_mem_;
+        template <class U, int other_size, class OtherThreading>
+        void operator()(Pointer<U, other_size, OtherThreading>& child)
+        {
+            if ((child.details_ != nullptr) && tracer_.visit(child.details_))
+            {
+                child.addr_ = nullptr;
+                child.details_ = nullptr;
+            }
+        }
+    };
+    static void trace_block(gc::ControlBlock* block, gc::Tracer& tracer);
 
 public:
     // Define an iterator type for Pointer<T>.
-    using GCiterator = Iter<T>;
+    using GCiterator = Iter<T, Policies::checked>;
 
     // A utility function that displays refContainer.
     static void show_list();
-    // Clear refContainer when program exits.
-    static void shutdown();
-    
+    // Clear refContainer when program exits. This frees the
+    // objects of every Pointer type with this Threading policy.
+    static void shutdown()
+    {
+        registry().shutdown();
+    }
+
     // NOTE: templates aren't able to have prototypes with default arguments
     // this is why constructor is designed like this:
-    Pointer()
+    Pointer() : Pointer(nullptr)
     {
-        Pointer(nullptr);
     }
 
-    Pointer(T* mem);  
-    Pointer(const Pointer& rhs);   
-    ~Pointer(); 
+    // With gc::dynamic_size mem has to be managed already, for
+    // other memory std::invalid_argument is thrown and the caller
+    // still owns it. The same holds for assigning a T*, which
+    // leaves the Pointer unchanged then.
+    Pointer(T* mem);
+    // Adopt length elements allocated with new[]. Only for Pointers
+    // with gc::dynamic_size, other Pointers know their length.
+    Pointer(T* mem, size_t length);
+    Pointer(const Pointer& rhs);
+    Pointer(Pointer&& rhs) noexcept;
+    ~Pointer();
+
+    // Construct a new T with args, or size value initialized
+    // elements for array Pointers, in a pooled chunk that also
+    // holds its control block, see make_gc().
+    template <class... Args>
+    static Pointer make(Args&&... args);
+    // Same as make() for length value initialized elements
+    // of a Pointer with gc::dynamic_size.
+    static Pointer make_array(size_t length);
+    // Adopt every pointer of mems as Pointer(T*) would, in one pass:
+    // each registry shard is locked once and grown to fit before its
+    // entries go in. The Pointers come back in the order of mems,
+    // null ones stay null.
+    static std::vector<Pointer> adopt_many(gc::Span<T* const> mems);
 
-    // Collect garbage. Returns true if at least
-    // one object was freed.
-    static bool collect();
+    // Collect garbage of every Pointer type with this Threading
+    // policy. Returns how many objects and bytes were freed.
+    static gc::CollectResult collect()
+    {
+        return registry().collect();
+    }
+    // Collect part of the registry, at most budget.entries
+    // entries or budget.time per call, resuming where the
+    // previous call stopped.
+    static gc::CollectResult collect_incremental(const gc::CollectBudget& budget)
+    {
+        return registry().collect_incremental(budget);
+    }
+    // Free groups of objects that only refer to each other.
+    // Concurrent Pointers must not be used by other
+    // threads while it runs.
+    static gc::CollectResult collect_cycles()
+    {
+        return registry().collect_cycles();
+    }
+    // One bounded step of collect_cycles(), resuming where the
+    // previous step stopped.
+    static gc::CollectResult collect_cycles_incremental(const gc::CollectBudget& budget)
+    {
+        return registry().collect_cycles_incremental(budget);
+    }
     // Overload assignment of pointer to Pointer.
     T* operator=(T* memory);
     // Overload assignment of Pointer to Pointer.
     Pointer& operator=(const Pointer &rhs);
-    
+    // Overload move assignment of Pointer to Pointer.
+    Pointer& operator=(Pointer&& rhs) noexcept;
+
     // Return a reference to the object pointed
     // to by this Pointer.
     T& operator*()
@@ -76,18 +315,20 @@ public:
     }
 
     // Return the address being pointed to.
-    T* operator->() 
-    { 
+    T* operator->()
+    {
         return addr_;
     }
 
     // Return a reference to the object at the
     // index specified by i.
     T& operator[](size_t index)
-    { 
-        if (is_array_)
+    {
+        // Only array Pointers have is_array_ set, knowing
+        // that at compile time keeps it out of loops.
+        if ((size != 0) && is_array_)
         {
-            if (index >= array_size_)
+            if (Policies::checked && (index >= array_size_))
             {
                 throw std::out_of_range("Invalid index");
             }
@@ -101,11 +342,20 @@ public:
     }
 
     // Conversion function to T *.
-    operator T*() 
+    operator T*()
     {
-        return addr_; 
+        return addr_;
     }
-    
+
+    // Return the elements as a contiguous range without bounds
+    // checks, for standard algorithms and loops that should
+    // vectorize. A single object is a range of one.
+    gc::Span<T> span()
+    {
+        size_t length = (addr_ == nullptr) ? 0 : (is_array_ ? array_size_ : 1);
+        return gc::Span<T>(addr_, length);
+    }
+
     // Return an Iter to the start of the allocated memory.
     GCiterator begin()
     {
@@ -128,43 +378,103 @@ public:
         if (is_array_)
         {
             lsize = array_size_;
-        }           
+        }
         else
         {
             lsize = 1;
-        }            
+        }
         return GCiterator(addr_ + lsize, addr_, addr_ + lsize);
     }
 
-    static int ref_container_size() 
-    { 
-        return sRefContainer.size();
-    }
+    static int ref_container_size();
 
 };
 
-// STATIC INITIALIZATION
-// Creates storage for the static variables
-template <class T, int size>
-std::list<PtrDetails<T>> Pointer<T, size>::sRefContainer;
+// A Pointer that can be copied, assigned and released
+// from several threads at once.
+template <class T, int size = 0>
+using ConcurrentPointer = Pointer<T, size, gc::MultiThreaded>;
 
+// Create a managed T the way std::make_shared does: object and
+// control block share one allocation from the size class pools
+// and no registry lookup is needed.
+template <class T, class... Args>
+Pointer<T> make_gc(Args&&... args)
+{
+    return Pointer<T>::make(std::forward<Args>(args)...);
+}
+
+// Same as make_gc() for an array of size value initialized
+// elements.
 template <class T, int size>
-bool Pointer<T, size>::sFirst = true;
+Pointer<T, size> make_gc_array()
+{
+    static_assert(size > 0, "make_gc_array() needs a positive size");
+    return Pointer<T, size>::make();
+}
 
-template<class T,int size>
-Pointer<T,size>::Pointer(T* mem)
+// Array Pointer whose length is kept at run time, so buffers of
+// every length have the same type:
+//
+//     Pointer<int[]> buffer(new int[n], n);
+//
+// It is a Pointer<T, gc::dynamic_size> under a nicer name.
+template <class T, int size, class Threading>
+class Pointer<T[], size, Threading> : public Pointer<T, gc::dynamic_size, Threading>
 {
-    // Register shutdown() as an exit function.
-    if (sFirst)
+    static_assert(size == 0, "Pointer<T[]> takes its length at run time");
+    using Base = Pointer<T, gc::dynamic_size, Threading>;
+
+public:
+    using Base::Base;
+
+    Pointer() = default;
+
+    Pointer(const Base& rhs) : Base(rhs)
+    {
+    }
+
+    Pointer(Base&& rhs) noexcept : Base(std::move(rhs))
     {
-        atexit(shutdown);
-        sFirst = false;
     }
 
+    using Base::operator=;
+};
+
+// Same as make_gc() for an array of length value initialized
+// elements, the length is only known at run time.
+template <class T>
+Pointer<T[]> make_gc_array(size_t length)
+{
+    return Pointer<T, gc::dynamic_size>::make_array(length);
+}
+
+// STATIC INITIALIZATION
+// Creates storage for the static variables
+template <class T, int size, class Threading>
+const gc::ManagedType& Pointer<T, size, Threading>::sType =
+    gc::PointerType<T, size, typename gc::PolicyTraits<Threading>::threading>::value;
+
+// Only the policies that pick the registry matter
+// to destroying and tracing an object.
+template <class T, int size, class Threading>
+const gc::ManagedType gc::PointerType<T, size, Threading>::value =
+{
+    &Pointer<T, size, Threading>::destroy_block,
+    gc::Children<T>::traced ? &Pointer<T, size, Threading>::trace_block : nullptr,
+    sizeof(T),
+    &typeid(T),
+    &Pointer<T, size, Threading>::block_address
+};
+
+template<class T, int size, class Threading>
+Pointer<T, size, Threading>::Pointer(T* mem)
+{
+    Registry::register_shutdown();
+
     if (size)
     {
         is_array_ = true;
-        array_size_ = size;
     }
 
     addr_ = mem;
@@ -174,243 +484,699 @@ Pointer<T,size>::Pointer(T* mem)
     {
         return;
     }
+    if (size == gc::dynamic_size)
+    {
+        array_size_ = sUnknownLength;
+    }
+    increment_or_add_to_ptr_list();
+}
+
+template<class T, int size, class Threading>
+Pointer<T, size, Threading>::Pointer(T* mem, size_t length)
+{
+    static_assert(size == gc::dynamic_size, "only Pointers with gc::dynamic_size take a length");
+    Registry::register_shutdown();
+
+    is_array_ = true;
+    array_size_ = length;
+    addr_ = mem;
+    if (addr_ == nullptr)
+    {
+        return;
+    }
     increment_or_add_to_ptr_list();
 }
 
+template<class T, int size, class Threading>
+Pointer<T, size, Threading>::Pointer(PtrDetails<T>* details, FromDetails) noexcept
+{
+    if (size)
+    {
+        is_array_ = true;
+        array_size_ = details->array_size_;
+    }
+    details_ = details;
+    addr_ = details->mem_ptr_;
+}
+
 // Copy constructor.
-template< class T, int size>
-Pointer<T,size>::Pointer(const Pointer &rhs)
+template<class T, int size, class Threading>
+Pointer<T, size, Threading>::Pointer(const Pointer &rhs)
 {
     addr_ = rhs.addr_;
     is_array_ = rhs.is_array_;
     array_size_ = rhs.array_size_;
-    
-    // If the rhs shared pointer was pointing to null don't do anything else
-    if(addr_ == nullptr)
-    {
-        return;
-    }
+    details_ = rhs.details_;
 
-    it_end_of_ptr_list_ = sRefContainer.end(); 
-    it_mem_ = find_ptr_info(addr_); 
-    
-    // There is def an issue if we can't find a memory, that is already handled by another shared ptr
-    // Possible issue is that the other pointer has been allocated on the stack
-    assert(it_mem_ != it_end_of_ptr_list_); 
-    it_mem_->ref_count_++;
+    increment_ptr_list();
+}
 
+// Move constructor. Ownership is handed over as is,
+// the reference count doesn't change.
+template<class T, int size, class Threading>
+Pointer<T, size, Threading>::Pointer(Pointer&& rhs) noexcept
+{
+    addr_ = rhs.addr_;
+    is_array_ = rhs.is_array_;
+    array_size_ = rhs.array_size_;
+    details_ = rhs.details_;
+
+    rhs.addr_ = nullptr;
+    rhs.details_ = nullptr;
 }
 
 // Destructor for Pointer.
-template <class T, int size>
-Pointer<T, size>::~Pointer()
-{  
-    typename std::list<PtrDetails<T>>::iterator end_of_list = sRefContainer.end();
-    typename std::list<PtrDetails<T>>::iterator p;
-    
-    if (addr_ != nullptr)
+template <class T, int size, class Threading>
+Pointer<T, size, Threading>::~Pointer()
+{
+    // Every Pointer gets here, make_gc_array() and Pointer<T[]>
+    // included. Not at class scope, T may still be incomplete there.
+    static_assert(!gc::IsIntrusive<T>::value || (size == 0), "intrusive objects can't be arrays");
+    release();
+}
+
+template <class T, int size, class Threading>
+template <class... Args>
+Pointer<T, size, Threading> Pointer<T, size, Threading>::make(Args&&... args)
+{
+    static_assert((size == 0) || (sizeof...(Args) == 0),
+                  "array elements are value initialized");
+    static_assert(size != gc::dynamic_size, "use make_array() for run time lengths");
+    return make_object(gc::IsIntrusive<T>(), std::forward<Args>(args)...);
+}
+
+template <class T, int size, class Threading>
+template <class... Args>
+Pointer<T, size, Threading> Pointer<T, size, Threading>::make_object(std::false_type, Args&&... args)
+{
+    return make_chunk((size > 0) ? size : 1, std::forward<Args>(args)...);
+}
+
+// The object carries the count, there is no control
+// block to put next to it.
+template <class T, int size, class Threading>
+template <class... Args>
+Pointer<T, size, Threading> Pointer<T, size, Threading>::make_object(std::true_type, Args&&... args)
+{
+    return Pointer(new T(std::forward<Args>(args)...));
+}
+
+template <class T, int size, class Threading>
+Pointer<T, size, Threading> Pointer<T, size, Threading>::make_array(size_t length)
+{
+    static_assert(size == gc::dynamic_size, "only Pointers with gc::dynamic_size take a length");
+    // Like new T[length], a length whose chunk size
+    // wraps around is refused instead of overrunning.
+    if (length > (SIZE_MAX - chunk_size(0)) / sizeof(T))
     {
-        p = find_ptr_info(addr_);
+        throw std::bad_array_new_length();
     }
+    return make_chunk(length);
+}
 
-    if((p != end_of_list)  && p->ref_count_)
+template <class T, int size, class Threading>
+template <class... Args>
+Pointer<T, size, Threading> Pointer<T, size, Threading>::make_chunk(size_t length, Args&&... args)
+{
+    Registry::register_shutdown();
+
+    void* chunk = pool().allocate(chunk_size(length));
+    T* mem = payload(chunk);
+    try
+    {
+        construct(mem, length, std::integral_constant<bool, (size != 0)>(), std::forward<Args>(args)...);
+    }
+    catch (...)
     {
-        p->ref_count_--;
-    }        
-    
-    collect();
+        pool().deallocate(chunk, chunk_size(length));
+        throw;
+    }
 
+    PtrDetails<T>* details = ::new (chunk) PtrDetails<T>(mem, &sType, size != 0, (size != 0) ? length : 0);
+    details->inline_ = true;
+    registry().note_allocated(details);
+    // Immediate frees on release, the nursery would only add a scan
+    // of it to every release. Deferred policies leave young garbage
+    // to the nursery sweeps.
+    if (Policies::collection::collect_policy() != gc::CollectPolicy::Immediate)
+    {
+        registry().add_young(details->mem_ptr_, details, Policies::collection::collect_policy());
+    }
+    else
+    {
+        register_details(details);
+    }
+    Pointer result(details, FromDetails());
+    registry().check_budget();
+    return result;
 }
 
-// Collect garbage. Returns true if at least
-// one object was freed.
-template <class T, int size>
-bool Pointer<T, size>::collect()
+template <class T, int size, class Threading>
+std::vector<Pointer<T, size, Threading> > Pointer<T, size, Threading>::adopt_many(gc::Span<T* const> mems)
 {
-    bool memfreed = false;
-    typename std::list<PtrDetails<T> >::iterator p;
-    
-    do
+    static_assert(size != gc::dynamic_size, "run time lengths are only known to Pointer(T*, size_t)");
+    std::vector<Pointer> result(mems.size());
+    // Intrusive objects and buffered registrations
+    // don't go through the shards.
+    if (gc::IsIntrusive<T>::value || (Registry::buffering_cache() != nullptr))
     {
-        // Scan refContainer looking for unreferenced pointers.
-        for (p = sRefContainer.begin(); p != sRefContainer.end(); p++)
+        for (size_t i = 0; i < mems.size(); i++)
         {
-            // If in-use, skip.
-            if (p->ref_count_ != 0)
+            result[i] = Pointer(mems[i]);
+        }
+        return result;
+    }
+    Registry::register_shutdown();
+
+    std::vector<size_t> order;
+    std::vector<size_t> starts;
+    Registry::group_by_shard(mems.size(), [&mems](size_t i) { return mems[i]; }, order, starts);
+
+    bool adopted = false;
+    for (size_t index = 0; index < Threading::shard_count; index++)
+    {
+        if (starts[index] == starts[index + 1])
+        {
+            continue;
+        }
+        Shard& shard = registry().shard_at(index);
+        Lock lock(shard.mutex_);
+        shard.refs_.reserve(shard.refs_.size() + (starts[index + 1] - starts[index]));
+        for (size_t j = starts[index]; j < starts[index + 1]; j++)
+        {
+            T* mem = mems[order[j]];
+            if (mem == nullptr)
             {
                 continue;
             }
-         
-            if(p->mem_ptr_ != nullptr)
+            PtrDetails<T>* details;
+            typename RefContainer::iterator it_mem = find_ptr_info(shard, mem);
+            if (it_mem != shard.refs_.end())
             {
-                if(p->is_array_)
-                {
-                    delete[] p->mem_ptr_;
-                }
-                else
-                {
-                    delete p->mem_ptr_;
-                }
-                memfreed = true;
+                // Managed already, or twice in mems
+                assert((it_mem->second->type_ == &sType) && (it_mem->second->is_array_ == (size != 0)));
+                Threading::add(it_mem->second->ref_count_, 1);
+                registry().note_ref_op();
+                details = static_cast<PtrDetails<T>*>(it_mem->second);
             }
-                       
-            sRefContainer.remove(*p);
-            break;
+            else
+            {
+                details = make_details(mem, size != 0, (size > 0) ? size : 0);
+                shard.refs_.emplace(mem, details);
+                adopted = true;
+            }
+            result[order[j]] = Pointer(details, FromDetails());
         }
-    } while (p != sRefContainer.end());
-    
-    return memfreed;
+    }
+    if (adopted)
+    {
+        registry().check_budget();
+    }
+    return result;
 }
 
-// Overload assignment of pointer to Pointer.
-template <class T, int size>
-T* Pointer<T, size>::operator=(T* mem)
+template <class T, int size, class Threading>
+template <class... Args>
+void Pointer<T, size, Threading>::construct(T* mem, size_t, std::false_type, Args&&... args)
+{
+    ::new (mem) T(std::forward<Args>(args)...);
+}
+
+// Elements that were already built are destroyed
+// again if a constructor throws.
+template <class T, int size, class Threading>
+void Pointer<T, size, Threading>::construct(T* mem, size_t length, std::true_type)
 {
-    if (addr_ != nullptr)
+    size_t constructed = 0;
+    try
+    {
+        for (; constructed < length; constructed++)
+        {
+            ::new (mem + constructed) T();
+        }
+    }
+    catch (...)
     {
-        it_end_of_ptr_list_ = sRefContainer.end(); 
-        it_mem_ = find_ptr_info(addr_); 
-        assert(it_mem_ != it_end_of_ptr_list_);
-        it_mem_->ref_count_--;
+        while (constructed > 0)
+        {
+            mem[--constructed].~T();
+        }
+        throw;
     }
+}
 
-    addr_ = mem;
-    if (size)
+// Overload assignment of pointer to Pointer.
+template <class T, int size, class Threading>
+T* Pointer<T, size, Threading>::operator=(T* mem)
+{
+    // Reassigning the memory we already own must not free it
+    if (mem == addr_)
     {
-        is_array_ = true;
-        array_size_ = size;
+        return addr_;
     }
-    increment_or_add_to_ptr_list();
+    // Adopted before the old memory is released, a refused
+    // adoption leaves this Pointer as it was.
+    Pointer adopted(mem);
+    *this = std::move(adopted);
     return addr_;
 }
 
-template<class T, int size>
-void Pointer<T, size>::increment_or_add_to_ptr_list()
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::increment_or_add_to_ptr_list()
 {
 
     if (addr_ == nullptr)
     {
         return;
-    }    
+    }
+    if (gc::IsIntrusive<T>::value)
+    {
+        intrusive_acquire(addr_, gc::IsIntrusive<T>());
+        return;
+    }
 
-    it_end_of_ptr_list_ = sRefContainer.end(); 
-    it_mem_ = find_ptr_info(addr_);    
-    // Find if we are just another user of a memory already allocated
-    if (it_mem_ != it_end_of_ptr_list_)
+    ThreadCache* cache = Registry::buffering_cache();
+    if (cache != nullptr)
     {
-        // This memory is already being used and looked after
-        // Make sure that both ptr details and this pointer properly indicate
-        // if the memory is an array, if not something is def wrong assert and exit
-        assert((it_mem_->is_array_ == is_array_) && (it_mem_->array_size_ == array_size_));
-        // Everything looks good increment 
-        it_mem_->ref_count_++;
+        // Only this thread's buffer is searched, the memory
+        // isn't expected to be managed anywhere else yet.
+        typename ThreadCache::Buffer::iterator it_mem = cache->buffered_.find(addr_);
+        if (it_mem != cache->buffered_.end())
+        {
+            gc::ControlBlock* block = it_mem->second.block_;
+            assert((block->type_ == &sType) && matches_length(block));
+            Threading::add(block->ref_count_, 1);
+            registry().note_ref_op();
+            details_ = static_cast<PtrDetails<T>*>(block);
+            array_size_ = details_->array_size_;
+            return;
+        }
+
+        if (!knows_length())
+        {
+            reject_unknown_length();
+        }
+        details_ = make_details(addr_, is_array_, array_size_);
+        register_details(details_);
+        registry().check_budget();
+        return;
     }
-    else
+
+    // Adopting a raw pointer is the only place that needs a lookup
+    bool adopted = false;
     {
-        // This is newly created memory
-        sRefContainer.emplace_back(addr_, array_size_);
+        Shard& shard = registry().shard_for(addr_);
+        Lock lock(shard.mutex_);
+        typename RefContainer::iterator it_mem = find_ptr_info(shard, addr_);
+        // Find if we are just another user of a memory already allocated
+        if (it_mem != shard.refs_.end())
+        {
+            // This memory is already being used and looked after
+            // Make sure that both ptr details and this pointer properly indicate
+            // if the memory is an array, if not something is def wrong assert and exit.
+            // Pointers of another type can't share the memory either.
+            assert((it_mem->second->type_ == &sType) && matches_length(it_mem->second));
+            // Everything looks good increment
+            Threading::add(it_mem->second->ref_count_, 1);
+            registry().note_ref_op();
+        }
+        else if (!knows_length())
+        {
+            reject_unknown_length();
+        }
+        else
+        {
+            // This is newly created memory
+            it_mem = shard.refs_.emplace(addr_, make_details(addr_, is_array_, array_size_)).first;
+            adopted = true;
+        }
+        details_ = static_cast<PtrDetails<T>*>(it_mem->second);
+        array_size_ = details_->array_size_;
+    }
+    // Collecting takes the shard locks, the budget is
+    // only looked at once ours is released.
+    if (adopted)
+    {
+        registry().check_budget();
     }
 }
 
 // Overload assignment of Pointer to Pointer.
-template <class T, int size>
-Pointer<T, size>& Pointer<T, size>::operator=(const Pointer& rhs)
+template <class T, int size, class Threading>
+Pointer<T, size, Threading>& Pointer<T, size, Threading>::operator=(const Pointer& rhs)
 {
-    if (addr_ != nullptr)
+    // Self assignment must not drop the last reference
+    if (addr_ == rhs.addr_)
     {
-        it_end_of_ptr_list_ = sRefContainer.end(); 
-        it_mem_ = find_ptr_info(addr_); 
-        // There def is a problem, we should be able to find
-        // a memory address guided by this object if it wasn't null
-        assert(it_mem_ != it_end_of_ptr_list_);
-        it_mem_->ref_count_--;
+        return *this;
     }
+    release();
 
     addr_ = rhs.addr_;
     is_array_ = rhs.is_array_;
     array_size_ = rhs.array_size_;
-    
+    details_ = rhs.details_;
+
     increment_ptr_list();
     return *this;
 
 }
 
-template<class T, int size>
-void Pointer<T, size>::increment_ptr_list()
+// Overload move assignment of Pointer to Pointer.
+template <class T, int size, class Threading>
+Pointer<T, size, Threading>& Pointer<T, size, Threading>::operator=(Pointer&& rhs) noexcept
 {
-    if (addr_ == nullptr)
+    if (this == &rhs)
+    {
+        return *this;
+    }
+    release();
+
+    addr_ = rhs.addr_;
+    is_array_ = rhs.is_array_;
+    array_size_ = rhs.array_size_;
+    details_ = rhs.details_;
+
+    rhs.addr_ = nullptr;
+    rhs.details_ = nullptr;
+    return *this;
+}
+
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::increment_ptr_list()
+{
+    if (gc::IsIntrusive<T>::value)
     {
+        intrusive_acquire(addr_, gc::IsIntrusive<T>());
         return;
-    }   
+    }
+    // If the rhs shared pointer was pointing to null don't do anything else
+    if (details_ == nullptr)
+    {
+        return;
+    }
 
-    it_end_of_ptr_list_ = sRefContainer.end(); 
-    it_mem_ = find_ptr_info(addr_); 
+    // There is def an issue if the memory is already handled by another
+    // shared ptr but has no references left
+    assert(details_->ref_count_.load(std::memory_order_relaxed) != 0);
+    Threading::add(details_->ref_count_, 1);
+    registry().note_ref_op();
+}
+
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::release()
+{
+    PtrDetails<T>* details = details_;
+    T* mem = addr_;
+    addr_ = nullptr;
+    details_ = nullptr;
+    // Intrusive objects aren't registered, shutdown() doesn't free
+    // them and they are released the same way during it.
+    if (gc::IsIntrusive<T>::value)
+    {
+        intrusive_release(mem, gc::IsIntrusive<T>());
+        return;
+    }
+    // Once shutdown() runs it owns every entry, Pointers
+    // destroyed by it must leave the registry alone.
+    if ((details == nullptr) || registry().shutting_down())
+    {
+        return;
+    }
+    // Objects freed on the background collector may hold single
+    // threaded Pointers, the thread using them applies the release.
+    if (!Threading::background_collection)
+    {
+        if (gc::BackgroundCollector::on_collector_thread())
+        {
+            registry().hand_back({mem, details, Policies::collection::collect_policy(),
+                                  sizeof(T) * (is_array_ ? array_size_ : 1)});
+            return;
+        }
+        registry().apply_handed_back();
+    }
 
-    // There is def an issue if we can't find a memory, that is already handled by another shared ptr
-    // Possible issue is that the other pointer has been allocated on the stack
-    assert(it_mem_ != it_end_of_ptr_list_); 
-    it_mem_->ref_count_++;
+    // Read before the decrement, afterwards only the owning
+    // thread may touch a buffered control block.
+    const void* owner = nullptr;
+    if (Threading::buffer_registrations)
+    {
+        owner = details->owner_.load(std::memory_order_acquire);
+    }
+
+    // A ReleaseScope on this thread takes the decrement over.
+    if (owner == nullptr)
+    {
+        typename Registry::ReleaseQueue* deferring = registry().deferring_queue();
+        if (deferring != nullptr)
+        {
+            registry().note_ref_op();
+            deferring->deferred_.push_back({mem, details, Policies::collection::collect_policy(),
+                                            sizeof(T) * (is_array_ ? array_size_ : 1)});
+            return;
+        }
+    }
+
+    registry().note_ref_op();
+    if (Threading::decrement(details->ref_count_) != 0)
+    {
+        return;
+    }
+
+    gc::CollectPolicy policy = Policies::collection::collect_policy();
+    if (owner != nullptr)
+    {
+        ThreadCache* cache = Registry::thread_cache();
+        if ((owner == cache) && (policy == gc::CollectPolicy::Immediate))
+        {
+            // Still private to this thread, nobody else can see it
+            cache->buffered_.erase(mem);
+            Registry::dispose(details);
+            return;
+        }
+        // Buffered by another thread, which frees the memory if it
+        // flushes after the decrement. If it published the block
+        // before, the lookup under the shard lock below finds the
+        // entry, details must not be read to tell which happened.
+        // Under the deferred policies the owning thread's flush
+        // publishes the dead block for collect(), it counts as
+        // pending below like any other release.
+    }
+
+    // From here on details may already be gone, another thread
+    // could have adopted and released the same memory meanwhile.
+    if (policy != gc::CollectPolicy::Immediate)
+    {
+        // Leave the entry for the next collect(), it frees
+        // every unreferenced entry in one sweep.
+        if (registry().add_pending(sizeof(T) * (is_array_ ? array_size_ : 1), policy))
+        {
+            registry().collect_threshold();
+        }
+        return;
+    }
+
+    // Last reference is gone, free the memory right away
+    // instead of rescanning the whole registry. The entry is looked
+    // up again under the lock in case it was adopted once more,
+    // possibly by a Pointer of another type.
+    gc::ControlBlock* block;
+    {
+        Shard& shard = registry().shard_for(mem);
+        Lock lock(shard.mutex_);
+        typename RefContainer::iterator it_mem = find_ptr_info(shard, mem);
+        if ((it_mem == shard.refs_.end()) ||
+            (it_mem->second->ref_count_.load(std::memory_order_acquire) != 0))
+        {
+            return;
+        }
+        block = it_mem->second;
+        shard.refs_.erase(it_mem);
+    }
+    Registry::dispose(block);
 }
 
-// A utility function that displays refContainer.
-template <class T, int size>
-void Pointer<T, size>::show_list()
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::intrusive_acquire(T* mem, std::true_type)
 {
-    typename std::list<PtrDetails<T> >::iterator p;
-    std::cout << "refContainer<" << typeid(T).name() << ", " << size << ">:\n";
-    std::cout << "memPtr refcount value\n ";
-    if (sRefContainer.begin() == sRefContainer.end())
+    if (mem != nullptr)
     {
-        std::cout << " Container is empty!\n\n ";
+        Threading::add(gc::IntrusiveAccess::count(mem), 1);
     }
-    
-    for (p = sRefContainer.begin(); p != sRefContainer.end(); p++)
+}
+
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::intrusive_release(T* mem, std::true_type)
+{
+    if ((mem != nullptr) && (Threading::decrement(gc::IntrusiveAccess::count(mem)) == 0))
     {
-        std::cout << "[" << (void *)p->memPtr << "]"
-             << " " << p->refcount << " ";
-        if (p->memPtr)
-            std::cout << " " << *p->memPtr;
-        else
-            std::cout << "---";
-        std::cout << std::endl;
+        delete mem;
     }
-    std::cout << std::endl;
 }
 
-// Find a pointer in refContainer
-// Returns iterator pointing to end element of container if not found
-template <class T, int size>
-typename std::list<PtrDetails<T> >::iterator Pointer<T, size>::find_ptr_info(const T* ptr)
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::reject_unknown_length()
 {
-    typename std::list<PtrDetails<T> >::iterator p;
-    
-    // Find ptr in refContainer.
-    for (p = sRefContainer.begin(); p != sRefContainer.end(); p++)
+    addr_ = nullptr;
+    array_size_ = 0;
+    throw std::invalid_argument("Pointer<T[]> can't adopt unmanaged memory without its length");
+}
+
+// Delete managed memory. Callers unlink its entry
+// from refContainer themselves.
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::free_memory(T* mem, bool is_array)
+{
+    if (is_array)
+    {
+        delete[] mem;
+    }
+    else
     {
-        if (p->mem_ptr_ == ptr)
+        delete mem;
+    }
+}
+
+// Take a control block from the thread's free list,
+// or allocate one if it is empty.
+template<class T, int size, class Threading>
+PtrDetails<T>* Pointer<T, size, Threading>::make_details(T* mem, bool is_array, size_t arr_size)
+{
+    static_assert(sizeof(PtrDetails<T>) == Registry::block_size, "control blocks must share one size");
+    PtrDetails<T>* details = ::new (registry().allocate_block()) PtrDetails<T>(mem, &sType, is_array, arr_size);
+    registry().note_allocated(details);
+    return details;
+}
+
+// Return a control block that is no longer registered anywhere.
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::recycle_details(PtrDetails<T>* details)
+{
+    details->~PtrDetails<T>();
+    registry().free_block(details);
+}
+
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::destroy(PtrDetails<T>* details)
+{
+    // Cycles and shutdown() free objects that are still referenced,
+    // WeakPointers must not bring them back.
+    details->ref_count_.store(0, std::memory_order_relaxed);
+    registry().note_freed(details);
+    if (!details->inline_)
+    {
+        free_memory(details->mem_ptr_, details->is_array_);
+    }
+    else
+    {
+        size_t count = details->is_array_ ? details->array_size_ : 1;
+        for (size_t i = 0; i < count; i++)
         {
-            return p;
+            details->mem_ptr_[i].~T();
         }
     }
-    // Return end of the container indicating pointer was not found
-    return p;
+    release_block(details);
 }
 
-// Clear refContainer when program exits.
-template <class T, int size>
-void Pointer<T, size>::shutdown()
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::release_block(PtrDetails<T>* details)
 {
-    if (ref_container_size() == 0)
+    // shutdown() frees every block, WeakPointers left
+    // behind leave it alone from then on.
+    if ((Threading::decrement(details->weak_count_) != 0) && !registry().shutting_down())
     {
         return;
     }
-        
-    typename std::list<PtrDetails<T> >::iterator p;
-    
-    for (p = sRefContainer.begin(); p != sRefContainer.end(); p++)
+    if (!details->inline_)
     {
-        // Set all reference counts to zero
-        p->ref_count_ = 0;
-    }   
-    collect();
-}
\ No newline at end of file
+        recycle_details(details);
+        return;
+    }
+    // Objects built by make() keep their memory until the
+    // last WeakPointer is gone, it is the same chunk.
+    size_t count = details->is_array_ ? details->array_size_ : 1;
+    details->~PtrDetails<T>();
+    pool().deallocate(details, chunk_size(count));
+}
+
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::register_details(PtrDetails<T>* details)
+{
+    registry().add(details->mem_ptr_, details, Policies::collection::collect_policy());
+}
+
+template<class T, int size, class Threading>
+void Pointer<T, size, Threading>::trace_block(gc::ControlBlock* block, gc::Tracer& tracer)
+{
+    PtrDetails<T>* details = static_cast<PtrDetails<T>*>(block);
+    ChildVisitor visitor{tracer};
+    size_t count = details->is_array_ ? details->array_size_ : 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        gc::Children<T>::visit(details->mem_ptr_[i], visitor);
+    }
+}
+
+// Number of entries of this Pointer type.
+template <class T, int size, class Threading>
+int Pointer<T, size, Threading>::ref_container_size()
+{
+    size_t total = 0;
+    registry().for_each([&total](const void*, gc::ControlBlock* block)
+    {
+        total += (block->type_ == &sType);
+    });
+    // Other threads' buffers aren't visible from here
+    ThreadCache* cache = Registry::thread_cache();
+    if (cache != nullptr)
+    {
+        typename ThreadCache::Buffer::iterator p;
+        for (p = cache->buffered_.begin(); p != cache->buffered_.end(); p++)
+        {
+            total += (p->second.block_->type_ == &sType);
+        }
+    }
+    return total;
+}
+
+// A utility function that displays refContainer.
+template <class T, int size, class Threading>
+void Pointer<T, size, Threading>::show_list()
+{
+    std::cout << "refContainer<" << typeid(T).name() << ", " << size << ">:\n";
+    std::cout << "memPtr refcount value\n ";
+    if (ref_container_size() == 0)
+    {
+        std::cout << " Container is empty!\n\n ";
+    }
+
+    registry().for_each([](const void*, gc::ControlBlock* block)
+    {
+        if (block->type_ != &sType)
+        {
+            return;
+        }
+        PtrDetails<T>* details = static_cast<PtrDetails<T>*>(block);
+        std::cout << "[" << (void *)details->mem_ptr_ << "]"
+             << " " << details->ref_count_.load() << " ";
+        if (details->mem_ptr_)
+            std::cout << " " << *details->mem_ptr_;
+        else
+            std::cout << "---";
+        std::cout << std::endl;
+    });
+    std::cout << std::endl;
+}
+
+// Find a pointer in refContainer
+// Returns iterator pointing to end element of container if not found
+template <class T, int size, class Threading>
+typename Pointer<T, size, Threading>::RefContainer::iterator
+Pointer<T, size, Threading>::find_ptr_info(Shard& shard, const T* ptr)
+{
+    // Hashed lookup, returns end of the container
+    // indicating pointer was not found
+    return registry().find(shard, ptr);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef GC_POLICY_H
+#define GC_POLICY_H
+
+#include "gc_collector.h"
+#include "gc_threading.h"
+
+namespace gc {
+
+// Collection policies. RuntimeCollection follows gc::set_collect_policy(),
+// FixedCollection decides at compile time and the release path
+// loses the branches it can't take.
+struct RuntimeCollection
+{
+    static CollectPolicy collect_policy()
+    {
+        return gc::collect_policy();
+    }
+};
+
+template <CollectPolicy policy>
+struct FixedCollection
+{
+    static constexpr CollectPolicy collect_policy()
+    {
+        return policy;
+    }
+};
+
+// Checking policies for Pointer::operator[] and Iter. Unchecked
+// access out of range is undefined, as with a raw pointer.
+struct Checked
+{
+    static const bool checked = true;
+};
+
+struct Unchecked
+{
+    static const bool checked = false;
+};
+
+// Building with GC_UNCHECKED drops the checks of every Pointer
+// that doesn't pick a checking policy itself.
+#ifdef GC_UNCHECKED
+using DefaultChecking = Unchecked;
+#else
+using DefaultChecking = Checked;
+#endif
+
+// Everything a Pointer decides at compile time, passed where the
+// threading policy goes:
+//
+//     using Fast = gc::Policy<gc::SingleThreaded,
+//                             gc::FixedCollection<gc::CollectPolicy::Immediate>,
+//                             gc::Unchecked>;
+//     Pointer<Particle, 0, Fast> p = Pointer<Particle, 0, Fast>::make();
+//
+// Pointers share the registry of their threading policy whatever
+// the other policies are, gc::collect() covers all of them. Whether
+// counts live in the object is up to the type, see gc::IntrusiveBase.
+template <class Threading, class Collection = RuntimeCollection, class Checking = DefaultChecking>
+struct Policy : Threading
+{
+};
+
+// What Pointer reads its policies from. A bare threading
+// policy gets the defaults for the rest.
+template <class P>
+struct PolicyTraits
+{
+    using threading = P;
+    using collection = RuntimeCollection;
+    static const bool checked = DefaultChecking::checked;
+};
+
+template <class Threading, class Collection, class Checking>
+struct PolicyTraits<Policy<Threading, Collection, Checking> >
+{
+    using threading = Threading;
+    using collection = Collection;
+    static const bool checked = Checking::checked;
+};
+
+} // namespace gc
+
+#endif
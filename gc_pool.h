@@ -0,0 +1,349 @@
+#ifndef GC_POOL_H
+#define GC_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace gc {
+
+// How the pools back their slabs, see gc::set_huge_pages().
+enum class HugePages
+{
+    None,         // ordinary pages
+    Transparent,  // ask the kernel to back regions with transparent huge pages
+    Explicit      // map reserved huge pages, transparent ones if none are left
+};
+
+// Settings of the size class pools. Both are looked at on every
+// allocation of a new region or chunk and may change at any time,
+// chunks always go back to the arena they came from.
+struct PoolConfig
+{
+    std::atomic<bool> node_arenas{false};
+    std::atomic<HugePages> huge_pages{HugePages::None};
+};
+
+inline PoolConfig& pool_config()
+{
+    static PoolConfig config;
+    return config;
+}
+
+// Give every NUMA node its own arena of size classes. make_gc()
+// objects, their control blocks and the control blocks of adopted
+// memory then come from memory on the node of the allocating thread,
+// so the reference count updates of that thread stay local. A thread
+// keeps the node it first allocated on, pin threads for this to hold.
+inline void set_node_arenas(bool enabled)
+{
+    pool_config().node_arenas.store(enabled);
+}
+
+// Back the regions slabs are carved from with huge pages, which
+// cuts TLB misses of heaps spread over many slabs. Only affects
+// regions allocated afterwards, and only Linux.
+inline void set_huge_pages(HugePages mode)
+{
+    pool_config().huge_pages.store(mode);
+}
+
+// NUMA node of the calling thread, looked up once per thread.
+inline size_t current_node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    thread_local long node = -1;
+    if (node < 0)
+    {
+        unsigned cpu = 0;
+        unsigned current = 0;
+        node = (syscall(SYS_getcpu, &cpu, &current, nullptr) == 0) ? current : 0;
+    }
+    return static_cast<size_t>(node);
+#else
+    return 0;
+#endif
+}
+
+// Slab allocator for control blocks and the objects created by
+// make_gc(). Requests are rounded up to a size class, every class
+// carves its chunks out of large slabs and keeps a free list of
+// chunks that were given back. Requests above max_size go straight
+// to operator new. Slabs are carved from regions of region_size,
+// which are returned when the pool is destroyed at exit.
+// With gc::set_node_arenas() every NUMA node has its own size
+// classes and regions, a slab's header tells which it belongs to.
+template <class Threading>
+class SizeClassPool
+{
+    public:
+        static const size_t granularity = 16;
+        static const size_t max_size = 512;
+        static const size_t slab_size = 64 * 1024;
+        // Large enough for a huge page, hosts with more nodes
+        // than arenas share them.
+        static const size_t region_size = 2 * 1024 * 1024;
+        static const size_t max_arenas = 8;
+        // Every chunk is aligned to this, and so is what operator
+        // new returns above max_size.
+        static const size_t alignment = (alignof(std::max_align_t) < granularity) ?
+                                        alignof(std::max_align_t) : granularity;
+
+        SizeClassPool() = default;
+        ~SizeClassPool();
+
+        void* allocate(size_t bytes);
+        void deallocate(void* ptr, size_t bytes) noexcept;
+
+    private:
+        using Lock = std::lock_guard<typename Threading::mutex_type>;
+
+        struct FreeChunk
+        {
+            FreeChunk* next_;
+        };
+
+        // Start of every slab, which is aligned to slab_size.
+        struct alignas(64) SlabHeader
+        {
+            size_t arena_;
+        };
+
+        struct alignas(64) SizeClass
+        {
+            typename Threading::mutex_type mutex_;
+            FreeChunk* free_ = nullptr;
+            // Unused tail of the slab this class carves from.
+            char* bump_ = nullptr;
+            char* bump_end_ = nullptr;
+        };
+
+        struct Arena
+        {
+            SizeClass classes_[max_size / granularity];
+            // Slabs left in the region this arena carves from,
+            // guarded by regions_mutex_.
+            char* next_slab_ = nullptr;
+            char* region_end_ = nullptr;
+        };
+
+        struct Region
+        {
+            void* base_;
+            size_t length_;
+        };
+
+        Arena arenas_[max_arenas];
+        typename Threading::mutex_type regions_mutex_;
+        std::vector<Region> regions_;
+        // Set once a chunk came from an arena other than the first,
+        // until then deallocate() doesn't read slab headers.
+        std::atomic<bool> spread_{false};
+
+        static size_t class_index(size_t bytes)
+        {
+            return (bytes + granularity - 1) / granularity - 1;
+        }
+
+        size_t arena_index()
+        {
+            if (!pool_config().node_arenas.load(std::memory_order_relaxed))
+            {
+                return 0;
+            }
+            size_t arena = current_node() % max_arenas;
+            if ((arena != 0) && !spread_.load(std::memory_order_relaxed))
+            {
+                spread_.store(true, std::memory_order_relaxed);
+            }
+            return arena;
+        }
+
+        // A fresh slab of the given arena, header written.
+        char* allocate_slab(size_t arena);
+        // Map region_size bytes aligned to region_size, placed on
+        // the calling thread's node if arenas are per node.
+        static Region allocate_region(bool node_local);
+        static void free_region(const Region& region) noexcept;
+
+        SizeClassPool(const SizeClassPool&) = delete;
+        SizeClassPool& operator=(const SizeClassPool&) = delete;
+};
+
+template <class Threading>
+SizeClassPool<Threading>::~SizeClassPool()
+{
+    for (size_t i = 0; i < regions_.size(); i++)
+    {
+        free_region(regions_[i]);
+    }
+}
+
+template <class Threading>
+void* SizeClassPool<Threading>::allocate(size_t bytes)
+{
+    if ((bytes == 0) || (bytes > max_size))
+    {
+        return ::operator new(bytes);
+    }
+
+    size_t index = class_index(bytes);
+    size_t chunk_size = (index + 1) * granularity;
+    size_t arena = arena_index();
+    SizeClass& size_class = arenas_[arena].classes_[index];
+    Lock lock(size_class.mutex_);
+
+    if (size_class.free_ != nullptr)
+    {
+        FreeChunk* chunk = size_class.free_;
+        size_class.free_ = chunk->next_;
+        return chunk;
+    }
+
+    if ((size_class.bump_end_ - size_class.bump_) < static_cast<std::ptrdiff_t>(chunk_size))
+    {
+        // The rest of the old slab is too small, it stays unused.
+        char* slab = allocate_slab(arena);
+        size_class.bump_ = slab + sizeof(SlabHeader);
+        size_class.bump_end_ = slab + slab_size;
+    }
+
+    void* chunk = size_class.bump_;
+    size_class.bump_ += chunk_size;
+    return chunk;
+}
+
+template <class Threading>
+void SizeClassPool<Threading>::deallocate(void* ptr, size_t bytes) noexcept
+{
+    if ((bytes == 0) || (bytes > max_size))
+    {
+        ::operator delete(ptr);
+        return;
+    }
+
+    size_t arena = 0;
+    if (spread_.load(std::memory_order_relaxed))
+    {
+        uintptr_t slab = reinterpret_cast<uintptr_t>(ptr) & ~static_cast<uintptr_t>(slab_size - 1);
+        arena = reinterpret_cast<const SlabHeader*>(slab)->arena_;
+    }
+    SizeClass& size_class = arenas_[arena].classes_[class_index(bytes)];
+    Lock lock(size_class.mutex_);
+    FreeChunk* chunk = static_cast<FreeChunk*>(ptr);
+    chunk->next_ = size_class.free_;
+    size_class.free_ = chunk;
+}
+
+template <class Threading>
+char* SizeClassPool<Threading>::allocate_slab(size_t arena)
+{
+    Arena& owner = arenas_[arena];
+    Lock lock(regions_mutex_);
+    if (owner.next_slab_ == owner.region_end_)
+    {
+        regions_.reserve(regions_.size() + 1);
+        Region region = allocate_region(pool_config().node_arenas.load(std::memory_order_relaxed));
+        regions_.push_back(region);
+        owner.next_slab_ = static_cast<char*>(region.base_);
+        owner.region_end_ = owner.next_slab_ + region_size;
+    }
+    char* slab = owner.next_slab_;
+    owner.next_slab_ += slab_size;
+    ::new (slab) SlabHeader{arena};
+    return slab;
+}
+
+template <class Threading>
+typename SizeClassPool<Threading>::Region SizeClassPool<Threading>::allocate_region(bool node_local)
+{
+#ifdef __linux__
+    HugePages huge = pool_config().huge_pages.load(std::memory_order_relaxed);
+    void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (huge == HugePages::Explicit)
+    {
+        // Huge pages are aligned to their size already.
+        base = mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (base == MAP_FAILED)
+    {
+        // Map twice the size and trim it to an aligned region.
+        char* mapped = static_cast<char*>(mmap(nullptr, 2 * region_size, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mapped == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        uintptr_t address = reinterpret_cast<uintptr_t>(mapped);
+        char* aligned = mapped + ((region_size - address % region_size) % region_size);
+        if (aligned != mapped)
+        {
+            munmap(mapped, aligned - mapped);
+        }
+        munmap(aligned + region_size, (mapped + 2 * region_size) - (aligned + region_size));
+        base = aligned;
+#ifdef MADV_HUGEPAGE
+        if (huge != HugePages::None)
+        {
+            madvise(base, region_size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+#ifdef SYS_mbind
+    // Pages land where they are first touched, which is mostly the
+    // allocating thread anyway. Preferring its node keeps them there
+    // when another thread touches a chunk first.
+    size_t node = current_node();
+    if (node_local && (node < 64))
+    {
+        const int preferred = 1;  // MPOL_PREFERRED
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, base, region_size, preferred, &mask, 64UL, 0U);
+    }
+#else
+    (void)node_local;
+#endif
+    return Region{base, region_size};
+#else
+    (void)node_local;
+    // Aligned by hand, the unused ends stay untouched.
+    char* mapped = static_cast<char*>(::operator new(2 * region_size));
+    uintptr_t address = reinterpret_cast<uintptr_t>(mapped);
+    char* aligned = mapped + ((region_size - address % region_size) % region_size);
+    return Region{aligned, static_cast<size_t>(aligned - mapped)};
+#endif
+}
+
+template <class Threading>
+void SizeClassPool<Threading>::free_region(const Region& region) noexcept
+{
+#ifdef __linux__
+    munmap(region.base_, region.length_);
+#else
+    // length_ holds the offset of the aligned base.
+    ::operator delete(static_cast<char*>(region.base_) - region.length_);
+#endif
+}
+
+// The pool shared by every Pointer with the given threading policy.
+template <class Threading>
+SizeClassPool<Threading>& size_class_pool()
+{
+    static SizeClassPool<Threading> pool;
+    return pool;
+}
+
+} // namespace gc
+
+#endif
@@ -0,0 +1,1782 @@
+#ifndef GC_REGISTRY_H
+#define GC_REGISTRY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "gc_background.h"
+#include "gc_collector.h"
+#include "gc_details.h"
+#include "gc_pool.h"
+#include "gc_threading.h"
+#include "gc_trace.h"
+
+namespace gc {
+
+// Control blocks of every Pointer type with the given threading
+// policy, keyed by the address of the managed memory. Each block
+// knows how to destroy its object, so collect(), the cycle
+// collector and shutdown() cover the whole heap in one pass.
+template <class Threading>
+class Registry
+{
+    public:
+        using RefContainer = std::unordered_map<const void*, ControlBlock*>;
+        using Lock = std::lock_guard<typename Threading::mutex_type>;
+
+        // Control blocks of adopted memory all have this size,
+        // PtrDetails<T> only adds a pointer.
+        static const size_t block_size = sizeof(PtrDetails<void>);
+
+        // An object of the nursery, see gc::set_nursery_size().
+        struct YoungEntry
+        {
+            const void* key_;
+            ControlBlock* block_;
+            // Collect policy the object was built under.
+            CollectPolicy policy_;
+        };
+
+        // The registry is split in shards, each guarded by its own lock.
+        // Single threaded Pointers use one shard and a lock that does nothing.
+        struct alignas(64) Shard
+        {
+            typename Threading::mutex_type mutex_;
+            RefContainer refs_;
+            // Objects built by make() that no sweep has seen yet, in
+            // the order they were built. Appending costs no node
+            // allocation, the survivors of a sweep move to refs_.
+            std::vector<YoungEntry> young_;
+            // young_ by key, so find() doesn't scan it on a miss. Open
+            // addressing at most half full, a slot holds the entry's
+            // position plus one and 0 if it is free.
+            std::vector<size_t> young_index_;
+        };
+
+        // Per-thread state, see gc::set_thread_cache().
+        struct ThreadCache
+        {
+            // A registration of this thread, with the collect
+            // policy its object was registered under.
+            struct Buffered
+            {
+                ControlBlock* block_;
+                CollectPolicy policy_;
+            };
+            using Buffer = std::unordered_map<const void*, Buffered>;
+            struct Entry
+            {
+                size_t shard_;
+                const void* key_;
+                Buffered buffered_;
+            };
+
+            // Registered on this thread, not published yet.
+            Buffer buffered_;
+            // Memory of destroyed control blocks kept for reuse.
+            std::vector<void*> free_blocks_;
+            // Scratch space for flush_thread_cache().
+            std::vector<Entry> batch_;
+            size_t since_flush_ = 0;
+
+            ~ThreadCache();
+        };
+
+        // Releases a ReleaseScope held back. Always per thread, the
+        // Pointers of the single threaded registry are released on
+        // the thread that uses them as well.
+        struct ReleaseQueue
+        {
+            struct Deferred
+            {
+                const void* key_;
+                ControlBlock* block_;
+                CollectPolicy policy_;
+                // Taken while the reference was still held, the block
+                // may be gone once the decrement is applied.
+                size_t bytes_;
+            };
+
+            std::vector<Deferred> deferred_;
+            // ReleaseScopes open on this thread.
+            size_t scopes_ = 0;
+
+            ~ReleaseQueue();
+        };
+
+        Registry() = default;
+
+        // Register shutdown() as an exit function, exactly once
+        // even when the first Pointers are created concurrently.
+        // The registry, pool and cache are built first so they
+        // are still there when shutdown() runs.
+        static void register_shutdown();
+
+        // nullptr once the calling thread destroyed its cache.
+        static ThreadCache* thread_cache()
+        {
+            return Threading::template local<ThreadCache>();
+        }
+
+        // The cache of the calling thread if registrations
+        // should be buffered in it, nullptr otherwise.
+        static ThreadCache* buffering_cache();
+
+        // Where releases go if a ReleaseScope is open on the
+        // calling thread, nullptr otherwise.
+        ReleaseQueue* deferring_queue()
+        {
+            if (open_scopes_.load(std::memory_order_relaxed) == 0)
+            {
+                return nullptr;
+            }
+            ReleaseQueue* queue = MultiThreaded::local<ReleaseQueue>();
+            return ((queue != nullptr) && (queue->scopes_ != 0)) ? queue : nullptr;
+        }
+        // See ReleaseScope. Leaving the outermost scope of a
+        // thread applies its deferred releases.
+        ReleaseQueue* enter_release_scope();
+        void leave_release_scope(ReleaseQueue* queue);
+        // Leave a release to the thread using this registry, for
+        // destructors on the background collector. Only registries
+        // that can't collect in the background need it.
+        void hand_back(const typename ReleaseQueue::Deferred& release);
+        // Apply the releases handed back so far. Called by the
+        // thread using the registry.
+        void apply_handed_back()
+        {
+            if (handed_back_count_.load(std::memory_order_acquire) != 0)
+            {
+                take_handed_back();
+            }
+        }
+
+        Shard& shard_for(const void* ptr)
+        {
+            return shards_[shard_index(ptr)];
+        }
+        Shard& shard_at(size_t index)
+        {
+            return shards_[index];
+        }
+        // Sort the indices [0, count) of a batch by the shard of
+        // key(i) in linear time, so handling it takes every shard lock
+        // once. The indices of shard s end up in order between
+        // starts[s] and starts[s + 1].
+        template <class Key>
+        static void group_by_shard(size_t count, Key key, std::vector<size_t>& order, std::vector<size_t>& starts);
+
+        // Enter a control block nobody else can see yet, for an
+        // object registered under policy.
+        void add(const void* key, ControlBlock* block, CollectPolicy policy);
+        // Enter the control block of a new object built under policy
+        // in the nursery, sweeping the shard's part of it once that
+        // is full. Falls back to add() if the nursery is off or
+        // registrations are buffered. No registry lock may be held
+        // by the caller.
+        void add_young(const void* key, ControlBlock* block, CollectPolicy policy);
+        // Look up the entry of key in shard, whose lock the caller
+        // holds. An object found in the nursery moves to the registry
+        // proper first. Returns the end of the shard's refs_ if
+        // the memory isn't managed.
+        typename RefContainer::iterator find(Shard& shard, const void* key);
+        // Publish the calling thread's buffered registrations.
+        // Unreferenced ones registered under Immediate are freed,
+        // the others wait in the registry for collect().
+        void flush_thread_cache(ThreadCache& cache);
+
+        // Destroy an unlinked control block, on the background
+        // collector if one runs for this threading policy.
+        static void dispose(ControlBlock* block)
+        {
+            if (!Threading::background_collection || !background_collector().push(block))
+            {
+                block->type_->destroy(block);
+            }
+        }
+
+        // Memory for the control block of adopted memory.
+        void* allocate_block();
+        // Give back the memory of a destroyed control block.
+        void free_block(void* block) noexcept;
+
+        // Note an unreferenced entry left for collect() under
+        // policy. Returns true once the Threshold policy
+        // should collect.
+        bool add_pending(size_t bytes, CollectPolicy policy);
+        // What the Threshold policy runs, a full collect() or an
+        // incremental step, see gc::set_collect_step().
+        CollectResult collect_threshold();
+
+        // Free every unreferenced entry, and unreachable cycles
+        // if gc::set_trace_cycles() enabled that.
+        CollectResult collect();
+        // Sweep part of the registry within budget, continuing where
+        // the previous call stopped. Cycles are left to collect() and
+        // collect_cycles_incremental().
+        CollectResult collect_incremental(const CollectBudget& budget);
+        // Free groups of objects that only refer to each other.
+        // Concurrent Pointers must not be used by other
+        // threads while it runs.
+        CollectResult collect_cycles();
+        // Trial deletion over part of the heap within budget,
+        // continuing where the previous step stopped. Garbage
+        // larger than a step is only found by collect_cycles().
+        CollectResult collect_cycles_incremental(const CollectBudget& budget);
+        // Sweep the nursery of every shard, leaving the rest of
+        // the registry alone.
+        CollectResult collect_young();
+        // Free everything, no matter the reference counts.
+        void shutdown();
+        // shutdown() with the shards split over threads.
+        void shutdown_parallel(size_t threads);
+        // Stop managing anything without freeing it.
+        void abandon();
+
+        // Heap an object takes, counting its control block.
+        static size_t footprint(const ControlBlock* block)
+        {
+            return block->bytes() + block_size;
+        }
+        // Bytes of every live object of this registry, see footprint().
+        size_t live_bytes() const
+        {
+            return live_bytes_.load(std::memory_order_relaxed);
+        }
+        void note_allocated(const ControlBlock* block)
+        {
+            Threading::add(live_bytes_, footprint(block));
+            Threading::add(allocated_objects_, 1);
+        }
+        void note_freed(const ControlBlock* block)
+        {
+            Threading::subtract(live_bytes_, footprint(block));
+            Threading::add(freed_objects_, 1);
+        }
+        // Count a reference count change if gc::set_count_ref_ops()
+        // asked for it.
+        void note_ref_op()
+        {
+            if (collector_config().count_ref_ops.load(std::memory_order_relaxed))
+            {
+                Threading::add(ref_ops_, 1);
+            }
+        }
+        // Add this registry's numbers to stats, the
+        // rate of reference count changes is left out.
+        void add_stats(Stats& stats);
+        // Call the pressure handler and collect if live_bytes()
+        // exceeds gc::set_heap_budget(). No registry lock may be
+        // held by the caller.
+        void check_budget()
+        {
+            size_t budget = collector_config().heap_budget.load(std::memory_order_relaxed);
+            if ((budget != 0) && (live_bytes() > budget))
+            {
+                relieve_pressure(budget);
+            }
+        }
+
+        bool shutting_down() const
+        {
+            return shutdown_.load(std::memory_order_relaxed);
+        }
+
+        // Call f(key, block) for every published entry,
+        // the nursery included.
+        template <class F>
+        void for_each(F f);
+
+    private:
+        Shard shards_[Threading::shard_count];
+        // Set once shutdown() started tearing the registry down.
+        std::atomic<bool> shutdown_{false};
+        // Unreferenced entries still waiting for collect() under
+        // the Threshold and Explicit policies.
+        std::atomic<size_t> pending_objects_{0};
+        std::atomic<size_t> pending_bytes_{0};
+        std::atomic<size_t> live_bytes_{0};
+        std::atomic<size_t> allocated_objects_{0};
+        std::atomic<size_t> freed_objects_{0};
+        std::atomic<size_t> ref_ops_{0};
+        std::atomic<size_t> collections_{0};
+        std::atomic<size_t> total_pause_ns_{0};
+        std::atomic<size_t> max_pause_ns_{0};
+        // If relieving pressure left the heap above its budget, the
+        // next attempt waits until it grew past this. Otherwise every
+        // allocation would collect once live objects fill the budget.
+        std::atomic<size_t> pressure_floor_{0};
+        // Set while one thread relieves pressure, the handler and the
+        // collection may allocate and must not start another round.
+        std::atomic<bool> relieving_{false};
+        // ReleaseScopes open on any thread, releases only look
+        // for their thread's scope while there are some. Scopes
+        // of any thread count here, whatever the policy.
+        std::atomic<size_t> open_scopes_{0};
+        // See hand_back(). Guarded by a real mutex whatever the
+        // threading policy, the collector thread pushes.
+        std::mutex handed_back_mutex_;
+        std::vector<typename ReleaseQueue::Deferred> handed_back_;
+        std::atomic<size_t> handed_back_count_{0};
+        // Where collect_incremental() continues, a bucket of one
+        // shard. Rehashing moves entries between buckets, those
+        // are found by a later pass.
+        typename Threading::mutex_type cursor_mutex_;
+        size_t cursor_shard_ = 0;
+        size_t cursor_bucket_ = 0;
+        // Where collect_cycles_incremental() takes its next
+        // candidates from, the same way.
+        typename Threading::mutex_type cycle_cursor_mutex_;
+        size_t cycle_shard_ = 0;
+        size_t cycle_bucket_ = 0;
+
+        static size_t shard_index(const void* ptr);
+        // Maintain young_ together with young_index_. The caller
+        // holds the shard's lock.
+        static void push_young(Shard& shard, const YoungEntry& entry);
+        static void clear_young(Shard& shard);
+        // Slot of key in young_index_, its size if key isn't young.
+        static size_t find_young(const Shard& shard, const void* key);
+        // Drop the entry of slot from the nursery.
+        static void remove_young(Shard& shard, size_t slot);
+        static size_t young_home(const Shard& shard, const void* key);
+        static void index_young(Shard& shard, size_t position);
+        static void shutdown_at_exit();
+        // The collections behind collect(), collect_incremental()
+        // and collect_cycles(), which time them and call the hooks.
+        CollectResult sweep();
+        CollectResult sweep_incremental(const CollectBudget& budget);
+        CollectResult sweep_cycles();
+        CollectResult sweep_cycles_incremental(const CollectBudget& budget);
+        // What trial deletion keeps for every object it looks at.
+        struct CycleTrace
+        {
+            size_t internal_ = 0;
+            bool reachable_ = false;
+        };
+        using CycleMap = std::unordered_map<ControlBlock*, CycleTrace>;
+        using CycleObjects = std::vector<std::pair<const void*, ControlBlock*> >;
+        // Trial deletion over objects, which traces holds an entry
+        // for each of. References from anything else count as ones
+        // from outside, the unreachable rest is freed.
+        void reclaim_cycles(const CycleObjects& objects, CycleMap& traces, CollectResult& result);
+        // Sweep the nurseries of shards [first, last). A sweep of a
+        // full nursery frees nothing built under Explicit.
+        CollectResult sweep_young(size_t first, size_t last, bool full_nursery = false);
+        // Destroy every object of shards [first, last) once
+        // shutdown_ is set.
+        void tear_down(size_t first, size_t last);
+        // Unlink the dead of shard's nursery into garbage and move
+        // the survivors to refs_, along with the dead built under
+        // Explicit if keep_explicit. The caller holds the shard's lock.
+        static void empty_nursery(Shard& shard, std::vector<ControlBlock*>& garbage, CollectResult& result,
+                                  bool keep_explicit = false);
+        template <class Sweep>
+        CollectResult timed(CollectKind kind, Sweep sweep);
+        void relieve_pressure(size_t budget);
+        // Take what a partial sweep freed off the pending counters.
+        void settle_pending(const CollectResult& freed);
+        // Drop the releases a ReleaseScope held back.
+        void apply_releases(ReleaseQueue& queue);
+        void take_handed_back();
+
+        Registry(const Registry&) = delete;
+        Registry& operator=(const Registry&) = delete;
+};
+
+// The registry shared by every Pointer with the given threading
+// policy. Constructed on first use, Pointers with static storage
+// may be created before it would be otherwise.
+template <class Threading>
+Registry<Threading>& registry()
+{
+    static Registry<Threading> instance;
+    return instance;
+}
+
+// Collect garbage of every Pointer type. Returns how many
+// objects and bytes were freed.
+inline CollectResult collect()
+{
+    CollectResult result = registry<SingleThreaded>().collect();
+    result += registry<MultiThreaded>().collect();
+    return result;
+}
+
+// Free unreachable cycles of every Pointer type.
+inline CollectResult collect_cycles()
+{
+    CollectResult result = registry<SingleThreaded>().collect_cycles();
+    result += registry<MultiThreaded>().collect_cycles();
+    return result;
+}
+
+// One cycle step of each registry within budget.
+inline CollectResult collect_cycles_incremental(const CollectBudget& budget)
+{
+    CollectResult result = registry<SingleThreaded>().collect_cycles_incremental(budget);
+    result += registry<MultiThreaded>().collect_cycles_incremental(budget);
+    return result;
+}
+
+// Sweep the nurseries of both registries.
+inline CollectResult collect_young()
+{
+    CollectResult result = registry<SingleThreaded>().collect_young();
+    result += registry<MultiThreaded>().collect_young();
+    return result;
+}
+
+// Holds back the releases of Pointers on this thread until the
+// scope ends, then applies them together: counts are decremented in
+// one pass, objects that reached zero are unlinked taking each shard
+// lock once and freed or left for collect() as their collect policy
+// says. Until then every released object stays alive. Scopes nest,
+// the outermost one applies. Intrusive objects, and ConcurrentPointers
+// still buffered in a thread cache, are released right away.
+//
+//     {
+//         gc::ReleaseScope scope;
+//         graph.clear();
+//     }
+class ReleaseScope
+{
+    public:
+        ReleaseScope()
+            : single_(registry<SingleThreaded>().enter_release_scope()),
+              multi_(registry<MultiThreaded>().enter_release_scope())
+        {
+        }
+
+        ~ReleaseScope()
+        {
+            registry<MultiThreaded>().leave_release_scope(multi_);
+            registry<SingleThreaded>().leave_release_scope(single_);
+        }
+
+    private:
+        Registry<SingleThreaded>::ReleaseQueue* single_;
+        Registry<MultiThreaded>::ReleaseQueue* multi_;
+
+        ReleaseScope(const ReleaseScope&) = delete;
+        ReleaseScope& operator=(const ReleaseScope&) = delete;
+};
+
+// Snapshot of both registries for metrics. Probe lengths are
+// measured by walking every shard, don't call it on a hot path.
+inline Stats stats()
+{
+    using Clock = std::chrono::steady_clock;
+    // Where the previous call left off, for the rate.
+    static std::mutex last_mutex;
+    static Clock::time_point last_time = Clock::now();
+    static size_t last_ref_ops = 0;
+
+    Stats result;
+    registry<SingleThreaded>().add_stats(result);
+    registry<MultiThreaded>().add_stats(result);
+
+    std::lock_guard<std::mutex> lock(last_mutex);
+    Clock::time_point now = Clock::now();
+    std::chrono::duration<double> elapsed = now - last_time;
+    if (elapsed.count() > 0)
+    {
+        result.ref_ops_per_second = (result.ref_ops - last_ref_ops) / elapsed.count();
+    }
+    last_time = now;
+    last_ref_ops = result.ref_ops;
+    return result;
+}
+
+template <class Threading>
+void Registry<Threading>::register_shutdown()
+{
+    static const bool registered = ((void)registry<Threading>(), (void)size_class_pool<Threading>(),
+                                    (void)thread_cache(), (void)background_collector(),
+                                    atexit(shutdown_at_exit) == 0);
+    (void)registered;
+}
+
+template <class Threading>
+void Registry<Threading>::shutdown_at_exit()
+{
+    const CollectorConfig& config = collector_config();
+    switch (config.shutdown_mode.load())
+    {
+        case ShutdownMode::Skip:
+            registry<Threading>().abandon();
+            break;
+        case ShutdownMode::Parallel:
+        {
+            size_t threads = config.shutdown_threads.load();
+            registry<Threading>().shutdown_parallel((threads != 0) ? threads : std::thread::hardware_concurrency());
+            break;
+        }
+        default:
+            registry<Threading>().shutdown();
+            break;
+    }
+}
+
+template <class Threading>
+typename Registry<Threading>::ThreadCache* Registry<Threading>::buffering_cache()
+{
+    if (!Threading::buffer_registrations ||
+        (thread_cache_config().cache_size.load(std::memory_order_relaxed) == 0))
+    {
+        return nullptr;
+    }
+    return thread_cache();
+}
+
+template <class Threading>
+void Registry<Threading>::add(const void* key, ControlBlock* block, CollectPolicy policy)
+{
+    ThreadCache* cache = buffering_cache();
+    if (cache != nullptr)
+    {
+        block->owner_.store(cache, std::memory_order_relaxed);
+        cache->buffered_.emplace(key, typename ThreadCache::Buffered{block, policy});
+        size_t cache_size = thread_cache_config().cache_size.load(std::memory_order_relaxed);
+        size_t flush_interval = thread_cache_config().flush_interval.load(std::memory_order_relaxed);
+        if ((cache->buffered_.size() >= cache_size) ||
+            ((flush_interval != 0) && (++cache->since_flush_ >= flush_interval)))
+        {
+            flush_thread_cache(*cache);
+        }
+        return;
+    }
+
+    Shard& shard = shard_for(key);
+    Lock lock(shard.mutex_);
+    shard.refs_.emplace(key, block);
+}
+
+template <class Threading>
+void Registry<Threading>::add_young(const void* key, ControlBlock* block, CollectPolicy policy)
+{
+    size_t nursery = collector_config().nursery_size.load(std::memory_order_relaxed);
+    if ((nursery == 0) || (buffering_cache() != nullptr))
+    {
+        add(key, block, policy);
+        return;
+    }
+
+    // Every shard gets its part of the nursery, one entry at least.
+    size_t limit = std::max<size_t>(nursery / Threading::shard_count, 1);
+    size_t index = shard_index(key);
+    Shard& shard = shards_[index];
+    {
+        Lock lock(shard.mutex_);
+        if (shard.young_.size() < limit)
+        {
+            push_young(shard, {key, block, policy});
+            return;
+        }
+    }
+    // Swept before the new object goes in, it would
+    // only survive because it was just built.
+    timed(CollectKind::Young, [this, index]() { return sweep_young(index, index + 1, true); });
+    Lock lock(shard.mutex_);
+    push_young(shard, {key, block, policy});
+}
+
+template <class Threading>
+typename Registry<Threading>::RefContainer::iterator Registry<Threading>::find(Shard& shard, const void* key)
+{
+    typename RefContainer::iterator it = shard.refs_.find(key);
+    if ((it != shard.refs_.end()) || shard.young_.empty())
+    {
+        return it;
+    }
+    // Adopting fresh memory misses here as well, the
+    // index answers that without a scan.
+    size_t slot = find_young(shard, key);
+    if (slot == shard.young_index_.size())
+    {
+        return it;
+    }
+    it = shard.refs_.emplace(key, shard.young_[shard.young_index_[slot] - 1].block_).first;
+    remove_young(shard, slot);
+    return it;
+}
+
+template <class Threading>
+void Registry<Threading>::flush_thread_cache(ThreadCache& cache)
+{
+    cache.since_flush_ = 0;
+    if (cache.buffered_.empty())
+    {
+        return;
+    }
+
+    // Sorted by shard so every lock is taken once per flush.
+    std::vector<typename ThreadCache::Entry>& batch = cache.batch_;
+    batch.clear();
+    typename ThreadCache::Buffer::iterator p;
+    for (p = cache.buffered_.begin(); p != cache.buffered_.end(); p++)
+    {
+        batch.push_back({shard_index(p->first), p->first, p->second});
+    }
+    cache.buffered_.clear();
+    std::sort(batch.begin(), batch.end(),
+              [](const typename ThreadCache::Entry& a, const typename ThreadCache::Entry& b)
+              {
+                  return a.shard_ < b.shard_;
+              });
+
+    std::vector<ControlBlock*> garbage;
+    size_t i = 0;
+    while (i < batch.size())
+    {
+        size_t index = batch[i].shard_;
+        Shard& shard = shards_[index];
+        Lock lock(shard.mutex_);
+        for (; (i < batch.size()) && (batch[i].shard_ == index); i++)
+        {
+            ControlBlock* block = batch[i].buffered_.block_;
+            // Nobody else can see a buffered block, unreferenced ones
+            // can be freed without going through the registry. Under
+            // the deferred policies release() counted them as pending
+            // already, they are published dead and wait for collect().
+            if ((block->ref_count_.load(std::memory_order_acquire) == 0) &&
+                (batch[i].buffered_.policy_ == CollectPolicy::Immediate))
+            {
+                garbage.push_back(block);
+                continue;
+            }
+            // A raw pointer adopted on two threads while
+            // the cache is on ends up here.
+            assert(shard.refs_.count(batch[i].key_) == 0);
+            shard.refs_.emplace(batch[i].key_, block);
+            block->owner_.store(nullptr, std::memory_order_release);
+        }
+    }
+
+    for (i = 0; i < garbage.size(); i++)
+    {
+        dispose(garbage[i]);
+    }
+}
+
+// Publish what is left when the thread exits.
+template <class Threading>
+Registry<Threading>::ThreadCache::~ThreadCache()
+{
+    if (!registry<Threading>().shutting_down())
+    {
+        registry<Threading>().flush_thread_cache(*this);
+    }
+    for (size_t i = 0; i < free_blocks_.size(); i++)
+    {
+        size_class_pool<Threading>().deallocate(free_blocks_[i], block_size);
+    }
+}
+
+// Take control block memory from the thread's free list,
+// or allocate it if the list is empty.
+template <class Threading>
+void* Registry<Threading>::allocate_block()
+{
+    ThreadCache* cache = thread_cache();
+    if ((cache == nullptr) || cache->free_blocks_.empty())
+    {
+        return size_class_pool<Threading>().allocate(block_size);
+    }
+    void* block = cache->free_blocks_.back();
+    cache->free_blocks_.pop_back();
+    return block;
+}
+
+template <class Threading>
+void Registry<Threading>::free_block(void* block) noexcept
+{
+    ThreadCache* cache = thread_cache();
+    if ((cache == nullptr) ||
+        (cache->free_blocks_.size() >= thread_cache_config().cache_size.load(std::memory_order_relaxed)))
+    {
+        size_class_pool<Threading>().deallocate(block, block_size);
+        return;
+    }
+    cache->free_blocks_.push_back(block);
+}
+
+template <class Threading>
+bool Registry<Threading>::add_pending(size_t bytes, CollectPolicy policy)
+{
+    const CollectorConfig& config = collector_config();
+    Threading::add(pending_objects_, 1);
+    Threading::add(pending_bytes_, bytes);
+    return (policy == CollectPolicy::Threshold) &&
+           ((pending_objects_.load(std::memory_order_relaxed) >= config.threshold_objects.load(std::memory_order_relaxed)) ||
+            (pending_bytes_.load(std::memory_order_relaxed) >= config.threshold_bytes.load(std::memory_order_relaxed)));
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::collect_threshold()
+{
+    const CollectorConfig& config = collector_config();
+    CollectBudget budget;
+    budget.entries = config.step_entries.load(std::memory_order_relaxed);
+    budget.time = std::chrono::microseconds(config.step_micros.load(std::memory_order_relaxed));
+    if ((budget.entries == 0) && (budget.time.count() == 0))
+    {
+        return collect();
+    }
+    CollectResult result = collect_incremental(budget);
+    if (config.trace_cycles.load(std::memory_order_relaxed))
+    {
+        result += collect_cycles_incremental(budget);
+    }
+    return result;
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::collect()
+{
+    return timed(CollectKind::Full, [this]() { return sweep(); });
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::collect_incremental(const CollectBudget& budget)
+{
+    return timed(CollectKind::Incremental, [this, &budget]() { return sweep_incremental(budget); });
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::collect_cycles()
+{
+    return timed(CollectKind::Cycles, [this]() { return sweep_cycles(); });
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::collect_cycles_incremental(const CollectBudget& budget)
+{
+    return timed(CollectKind::Cycles, [this, &budget]() { return sweep_cycles_incremental(budget); });
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::collect_young()
+{
+    return timed(CollectKind::Young, [this]() { return sweep_young(0, Threading::shard_count); });
+}
+
+template <class Threading>
+template <class Sweep>
+CollectResult Registry<Threading>::timed(CollectKind kind, Sweep sweep)
+{
+    using Clock = std::chrono::steady_clock;
+    const CollectorConfig& config = collector_config();
+    CollectEvent event{kind, std::is_same<Threading, MultiThreaded>::value, CollectResult(),
+                       std::chrono::nanoseconds(0)};
+    // Whatever the background collector handed back
+    // is garbage this collection should see.
+    apply_handed_back();
+    CollectHook begin = config.collect_begin.load(std::memory_order_relaxed);
+    if (begin != nullptr)
+    {
+        begin(event);
+    }
+
+    const Clock::time_point start = Clock::now();
+    event.result = sweep();
+    event.pause = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+
+    size_t pause = static_cast<size_t>(event.pause.count());
+    Threading::add(collections_, 1);
+    Threading::add(total_pause_ns_, pause);
+    size_t longest = max_pause_ns_.load(std::memory_order_relaxed);
+    while ((pause > longest) &&
+           !max_pause_ns_.compare_exchange_weak(longest, pause, std::memory_order_relaxed))
+    {
+    }
+
+    CollectHook end = config.collect_end.load(std::memory_order_relaxed);
+    if (end != nullptr)
+    {
+        end(event);
+    }
+    return event.result;
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::sweep()
+{
+    CollectResult result;
+    result.completed_pass = true;
+    // Unreferenced entries are unlinked in a single pass first and
+    // deleted afterwards. Destructors of the freed objects may release
+    // further Pointers, which must not invalidate the sweep.
+    std::vector<ControlBlock*> garbage;
+
+    // Registrations buffered by other threads are picked
+    // up after those threads flush.
+    ThreadCache* cache = thread_cache();
+    if (Threading::buffer_registrations && (cache != nullptr))
+    {
+        flush_thread_cache(*cache);
+    }
+
+    for (size_t i = 0; i < Threading::shard_count; i++)
+    {
+        Lock lock(shards_[i].mutex_);
+        RefContainer& refs = shards_[i].refs_;
+        typename RefContainer::iterator p = refs.begin();
+
+        // Scan refContainer looking for unreferenced pointers.
+        while (p != refs.end())
+        {
+            // If in-use, skip.
+            if (p->second->ref_count_.load(std::memory_order_acquire) != 0)
+            {
+                p++;
+                continue;
+            }
+
+            garbage.push_back(p->second);
+            result.objects++;
+            result.bytes += p->second->bytes();
+
+            p = refs.erase(p);
+        }
+        empty_nursery(shards_[i], garbage, result);
+    }
+
+    pending_objects_.store(0, std::memory_order_relaxed);
+    pending_bytes_.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < garbage.size(); i++)
+    {
+        dispose(garbage[i]);
+    }
+
+    if (collector_config().trace_cycles.load(std::memory_order_relaxed))
+    {
+        result += sweep_cycles();
+    }
+    return result;
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::sweep_incremental(const CollectBudget& budget)
+{
+    using Clock = std::chrono::steady_clock;
+    // Reading the clock costs about as much as checking an entry,
+    // it is only looked at every few buckets.
+    const size_t clock_interval = 64;
+    const Clock::time_point deadline = Clock::now() + budget.time;
+
+    CollectResult result;
+    std::vector<ControlBlock*> garbage;
+    std::vector<const void*> keys;
+
+    ThreadCache* cache = thread_cache();
+    if (Threading::buffer_registrations && (cache != nullptr))
+    {
+        flush_thread_cache(*cache);
+    }
+
+    {
+        Lock cursor_lock(cursor_mutex_);
+        size_t scanned = 0;
+        size_t buckets = 0;
+        bool exhausted = false;
+        while (!exhausted && (cursor_shard_ < Threading::shard_count))
+        {
+            Shard& shard = shards_[cursor_shard_];
+            Lock lock(shard.mutex_);
+            RefContainer& refs = shard.refs_;
+
+            // Erasing would invalidate the bucket iterators, the
+            // garbage found in this shard is unlinked afterwards.
+            keys.clear();
+            while (!exhausted && (cursor_bucket_ < refs.bucket_count()))
+            {
+                typename RefContainer::local_iterator p;
+                for (p = refs.begin(cursor_bucket_); p != refs.end(cursor_bucket_); p++)
+                {
+                    scanned++;
+                    if (p->second->ref_count_.load(std::memory_order_acquire) == 0)
+                    {
+                        keys.push_back(p->first);
+                    }
+                }
+                cursor_bucket_++;
+                buckets++;
+                exhausted = ((budget.entries != 0) && (scanned >= budget.entries)) ||
+                            ((budget.time.count() != 0) && ((buckets % clock_interval) == 0) &&
+                             (Clock::now() >= deadline));
+            }
+
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                typename RefContainer::iterator it = refs.find(keys[i]);
+                garbage.push_back(it->second);
+                result.objects++;
+                result.bytes += it->second->bytes();
+                refs.erase(it);
+            }
+
+            // The nursery goes with the shard's last step, its
+            // survivors are looked at again by the next pass.
+            if (cursor_bucket_ >= refs.bucket_count())
+            {
+                empty_nursery(shard, garbage, result);
+                cursor_shard_++;
+                cursor_bucket_ = 0;
+            }
+        }
+
+        if (cursor_shard_ == Threading::shard_count)
+        {
+            cursor_shard_ = 0;
+            result.completed_pass = true;
+        }
+    }
+
+    settle_pending(result);
+    for (size_t i = 0; i < garbage.size(); i++)
+    {
+        dispose(garbage[i]);
+    }
+    return result;
+}
+
+template <class Threading>
+CollectResult Registry<Threading>::sweep_young(size_t first, size_t last, bool full_nursery)
+{
+    CollectResult result;
+    result.completed_pass = true;
+    std::vector<ControlBlock*> garbage;
+    for (size_t i = first; i < last; i++)
+    {
+        Lock lock(shards_[i].mutex_);
+        empty_nursery(shards_[i], garbage, result, full_nursery);
+    }
+
+    settle_pending(result);
+    for (size_t i = 0; i < garbage.size(); i++)
+    {
+        dispose(garbage[i]);
+    }
+    return result;
+}
+
+// Survivors are promoted after a single sweep, which keeps the
+// nursery a plain list and every sweep proportional to its size.
+// Explicit garbage promoted as well waits for the next collect().
+template <class Threading>
+void Registry<Threading>::empty_nursery(Shard& shard, std::vector<ControlBlock*>& garbage, CollectResult& result,
+                                        bool keep_explicit)
+{
+    std::vector<YoungEntry>& young = shard.young_;
+    for (size_t i = 0; i < young.size(); i++)
+    {
+        ControlBlock* block = young[i].block_;
+        if ((block->ref_count_.load(std::memory_order_acquire) != 0) ||
+            (keep_explicit && (young[i].policy_ == CollectPolicy::Explicit)))
+        {
+            shard.refs_.emplace(young[i].key_, block);
+            continue;
+        }
+        garbage.push_back(block);
+        result.objects++;
+        result.bytes += block->bytes();
+    }
+    clear_young(shard);
+}
+
+template <class Threading>
+void Registry<Threading>::push_young(Shard& shard, const YoungEntry& entry)
+{
+    std::vector<size_t>& index = shard.young_index_;
+    if (2 * (shard.young_.size() + 1) > index.size())
+    {
+        std::vector<size_t>(std::max<size_t>(2 * index.size(), 16), 0).swap(index);
+        for (size_t i = 0; i < shard.young_.size(); i++)
+        {
+            index_young(shard, i);
+        }
+    }
+    shard.young_.push_back(entry);
+    index_young(shard, shard.young_.size() - 1);
+}
+
+template <class Threading>
+void Registry<Threading>::clear_young(Shard& shard)
+{
+    if (!shard.young_.empty())
+    {
+        shard.young_.clear();
+        std::fill(shard.young_index_.begin(), shard.young_index_.end(), 0);
+    }
+}
+
+template <class Threading>
+size_t Registry<Threading>::find_young(const Shard& shard, const void* key)
+{
+    const std::vector<size_t>& index = shard.young_index_;
+    if (shard.young_.empty())
+    {
+        return index.size();
+    }
+    size_t mask = index.size() - 1;
+    for (size_t slot = young_home(shard, key); index[slot] != 0; slot = (slot + 1) & mask)
+    {
+        if (shard.young_[index[slot] - 1].key_ == key)
+        {
+            return slot;
+        }
+    }
+    return index.size();
+}
+
+template <class Threading>
+void Registry<Threading>::remove_young(Shard& shard, size_t slot)
+{
+    std::vector<YoungEntry>& young = shard.young_;
+    std::vector<size_t>& index = shard.young_index_;
+    // The last entry fills the gap, its slot follows it.
+    size_t position = index[slot] - 1;
+    if (position != young.size() - 1)
+    {
+        index[find_young(shard, young.back().key_)] = position + 1;
+        young[position] = young.back();
+    }
+    young.pop_back();
+
+    // Shift later entries of the probe sequence back into the
+    // hole, unless that would put them before their home slot.
+    size_t mask = index.size() - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; index[next] != 0; next = (next + 1) & mask)
+    {
+        size_t home = young_home(shard, young[index[next] - 1].key_);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            index[hole] = index[next];
+            hole = next;
+        }
+    }
+    index[hole] = 0;
+}
+
+template <class Threading>
+size_t Registry<Threading>::young_home(const Shard& shard, const void* key)
+{
+    // shard_index() used the low bits already, a multiplicative
+    // hash spreads all of them over the table.
+    uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key) >> 4) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(hash >> 32) & (shard.young_index_.size() - 1);
+}
+
+template <class Threading>
+void Registry<Threading>::index_young(Shard& shard, size_t position)
+{
+    std::vector<size_t>& index = shard.young_index_;
+    size_t mask = index.size() - 1;
+    size_t slot = young_home(shard, shard.young_[position].key_);
+    while (index[slot] != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = position + 1;
+}
+
+// Whatever a thread exits with is released then.
+template <class Threading>
+Registry<Threading>::ReleaseQueue::~ReleaseQueue()
+{
+    if (!deferred_.empty())
+    {
+        registry<Threading>().apply_releases(*this);
+    }
+}
+
+template <class Threading>
+typename Registry<Threading>::ReleaseQueue* Registry<Threading>::enter_release_scope()
+{
+    ReleaseQueue* queue = MultiThreaded::local<ReleaseQueue>();
+    if (queue != nullptr)
+    {
+        queue->scopes_++;
+        open_scopes_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return queue;
+}
+
+template <class Threading>
+void Registry<Threading>::leave_release_scope(ReleaseQueue* queue)
+{
+    if (queue == nullptr)
+    {
+        return;
+    }
+    open_scopes_.fetch_sub(1, std::memory_order_relaxed);
+    if (--queue->scopes_ == 0)
+    {
+        apply_releases(*queue);
+    }
+}
+
+template <class Threading>
+void Registry<Threading>::apply_releases(ReleaseQueue& queue)
+{
+    using Deferred = typename ReleaseQueue::Deferred;
+    std::vector<Deferred> entries;
+    entries.swap(queue.deferred_);
+    if (entries.empty() || shutting_down())
+    {
+        return;
+    }
+
+    // Objects that are still referenced drop out, those with a
+    // deferred policy wait in the registry as after any release.
+    bool collect = false;
+    size_t dead = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        ControlBlock* block = entries[i].block_;
+        if (Threading::decrement(block->ref_count_) != 0)
+        {
+            continue;
+        }
+        if (entries[i].policy_ != CollectPolicy::Immediate)
+        {
+            collect = add_pending(entries[i].bytes_, entries[i].policy_) || collect;
+            continue;
+        }
+        entries[dead++] = entries[i];
+    }
+    entries.resize(dead);
+
+    std::vector<size_t> order;
+    std::vector<size_t> starts;
+    group_by_shard(entries.size(), [&entries](size_t i) { return entries[i].key_; }, order, starts);
+    std::vector<ControlBlock*> garbage;
+    for (size_t index = 0; index < Threading::shard_count; index++)
+    {
+        if (starts[index] == starts[index + 1])
+        {
+            continue;
+        }
+        Shard& shard = shards_[index];
+        Lock lock(shard.mutex_);
+        for (size_t j = starts[index]; j < starts[index + 1]; j++)
+        {
+            // Looked up again in case the memory was adopted
+            // once more since the count dropped to zero.
+            const void* key = entries[order[j]].key_;
+            typename RefContainer::iterator it = find(shard, key);
+            if ((it == shard.refs_.end()) || (it->second->ref_count_.load(std::memory_order_acquire) != 0))
+            {
+                continue;
+            }
+            garbage.push_back(it->second);
+            shard.refs_.erase(it);
+        }
+    }
+
+    // The scope's storage is kept for the next one, destructors
+    // below release right away as no scope is open any more.
+    entries.clear();
+    queue.deferred_.swap(entries);
+    for (size_t i = 0; i < garbage.size(); i++)
+    {
+        dispose(garbage[i]);
+    }
+    if (collect)
+    {
+        collect_threshold();
+    }
+}
+
+template <class Threading>
+void Registry<Threading>::hand_back(const typename ReleaseQueue::Deferred& release)
+{
+    std::lock_guard<std::mutex> lock(handed_back_mutex_);
+    handed_back_.push_back(release);
+    handed_back_count_.store(handed_back_.size(), std::memory_order_release);
+}
+
+// The releases are applied as a ReleaseScope would, the
+// references were held until now.
+template <class Threading>
+void Registry<Threading>::take_handed_back()
+{
+    ReleaseQueue queue;
+    {
+        std::lock_guard<std::mutex> lock(handed_back_mutex_);
+        queue.deferred_.swap(handed_back_);
+        handed_back_count_.store(0, std::memory_order_relaxed);
+    }
+    apply_releases(queue);
+}
+
+template <class Threading>
+void Registry<Threading>::settle_pending(const CollectResult& freed)
+{
+    size_t objects = pending_objects_.load(std::memory_order_relaxed);
+    size_t bytes = pending_bytes_.load(std::memory_order_relaxed);
+    pending_objects_.store((objects > freed.objects) ? (objects - freed.objects) : 0, std::memory_order_relaxed);
+    pending_bytes_.store((bytes > freed.bytes) ? (bytes - freed.bytes) : 0, std::memory_order_relaxed);
+}
+
+template <class Threading>
+void Registry<Threading>::add_stats(Stats& stats)
+{
+    size_t allocated = allocated_objects_.load(std::memory_order_relaxed);
+    size_t freed = freed_objects_.load(std::memory_order_relaxed);
+    stats.live_objects += (allocated > freed) ? (allocated - freed) : 0;
+    stats.live_bytes += live_bytes();
+    stats.objects_freed += freed;
+    stats.collections += collections_.load(std::memory_order_relaxed);
+    stats.total_pause += std::chrono::nanoseconds(total_pause_ns_.load(std::memory_order_relaxed));
+    stats.max_pause = std::max(stats.max_pause,
+                               std::chrono::nanoseconds(max_pause_ns_.load(std::memory_order_relaxed)));
+    stats.ref_ops += ref_ops_.load(std::memory_order_relaxed);
+
+    // A lookup compares with the entries of one bucket, finding
+    // the k-th entry of a bucket takes k comparisons.
+    double probes = stats.mean_probe_length * stats.registry_entries;
+    for (size_t i = 0; i < Threading::shard_count; i++)
+    {
+        Lock lock(shards_[i].mutex_);
+        const RefContainer& refs = shards_[i].refs_;
+        for (size_t bucket = 0; bucket < refs.bucket_count(); bucket++)
+        {
+            size_t entries = refs.bucket_size(bucket);
+            probes += entries * (entries + 1) / 2.0;
+            stats.max_probe_length = std::max(stats.max_probe_length, entries);
+        }
+        stats.registry_entries += refs.size();
+        stats.nursery_entries += shards_[i].young_.size();
+    }
+    if (stats.registry_entries != 0)
+    {
+        stats.mean_probe_length = probes / stats.registry_entries;
+    }
+}
+
+template <class Threading>
+void Registry<Threading>::relieve_pressure(size_t budget)
+{
+    size_t live = live_bytes();
+    size_t floor = pressure_floor_.load(std::memory_order_relaxed);
+    if (floor != 0)
+    {
+        if (live <= floor)
+        {
+            return;
+        }
+        pressure_floor_.store(0, std::memory_order_relaxed);
+    }
+    if (relieving_.exchange(true, std::memory_order_acquire))
+    {
+        return;
+    }
+
+    PressureHandler handler = collector_config().pressure_handler.load();
+    if (handler != nullptr)
+    {
+        handler(live, budget);
+    }
+    collect_threshold();
+
+    live = live_bytes();
+    if (live > budget)
+    {
+        pressure_floor_.store(live + budget / 2, std::memory_order_relaxed);
+    }
+    relieving_.store(false, std::memory_order_release);
+}
+
+// Trial deletion over the registry: references an object gets from
+// other managed objects are subtracted from its count, whatever still
+// has references left is held from outside and everything reachable
+// from there is live. The rest is only kept alive by cycles.
+template <class Threading>
+CollectResult Registry<Threading>::sweep_cycles()
+{
+    CollectResult result;
+    // Every object is traced, the pass always completes.
+    result.completed_pass = true;
+    ThreadCache* cache = thread_cache();
+    if (Threading::buffer_registrations && (cache != nullptr))
+    {
+        flush_thread_cache(*cache);
+    }
+
+    // Garbage is unlinked from refs_ below, the nursery
+    // is emptied first so everything is found there.
+    result += sweep_young(0, Threading::shard_count);
+
+    CycleMap traces;
+    CycleObjects objects;
+    for_each([&](const void* key, ControlBlock* block)
+    {
+        objects.emplace_back(key, block);
+        traces.emplace(block, CycleTrace());
+    });
+    reclaim_cycles(objects, traces, result);
+    return result;
+}
+
+// Candidates are the traced objects that are still referenced, the
+// cursor takes them a bucket at a time. Each joins the step together
+// with what it reaches, until the budget is spent, and trial deletion
+// runs over that part of the heap alone. References from the rest
+// count as outside ones, so a step frees a cycle only if it got hold
+// of all of it: garbage larger than a step is left to collect_cycles().
+template <class Threading>
+CollectResult Registry<Threading>::sweep_cycles_incremental(const CollectBudget& budget)
+{
+    using Clock = std::chrono::steady_clock;
+    // Reading the clock costs about as much as tracing an object,
+    // it is only looked at every few units of work.
+    const size_t clock_interval = 64;
+    const Clock::time_point deadline = Clock::now() + budget.time;
+
+    struct ChildTracer final : Tracer
+    {
+        std::vector<ControlBlock*>& children_;
+
+        explicit ChildTracer(std::vector<ControlBlock*>& children) : children_(children) {}
+
+        bool visit(ControlBlock* child) override
+        {
+            children_.push_back(child);
+            return false;
+        }
+    };
+
+    CollectResult result;
+    ThreadCache* cache = thread_cache();
+    if (Threading::buffer_registrations && (cache != nullptr))
+    {
+        flush_thread_cache(*cache);
+    }
+
+    CycleMap traces;
+    CycleObjects objects;
+    CycleObjects candidates;
+    CycleObjects frontier;
+    std::vector<ControlBlock*> children;
+    ChildTracer tracer(children);
+    size_t work = 0;
+    bool exhausted = false;
+    // Every bucket, traced object and looked up child counts.
+    auto spend = [&]()
+    {
+        work++;
+        exhausted = exhausted || ((budget.entries != 0) && (work >= budget.entries)) ||
+                    ((budget.time.count() != 0) && ((work % clock_interval) == 0) && (Clock::now() >= deadline));
+    };
+    {
+        Lock cursor_lock(cycle_cursor_mutex_);
+        bool first_bucket = true;
+        while (!exhausted && (cycle_shard_ < Threading::shard_count))
+        {
+            size_t shard_before = cycle_shard_;
+            size_t bucket_before = cycle_bucket_;
+            // The shard lock isn't held while children are looked
+            // up, they may live in any shard.
+            candidates.clear();
+            {
+                Shard& shard = shards_[cycle_shard_];
+                Lock lock(shard.mutex_);
+                RefContainer& refs = shard.refs_;
+                if (cycle_bucket_ < refs.bucket_count())
+                {
+                    typename RefContainer::local_iterator p;
+                    for (p = refs.begin(cycle_bucket_); p != refs.end(cycle_bucket_); p++)
+                    {
+                        ControlBlock* block = p->second;
+                        if ((block->type_->trace != nullptr) &&
+                            (block->ref_count_.load(std::memory_order_acquire) != 0))
+                        {
+                            candidates.emplace_back(p->first, block);
+                        }
+                    }
+                    cycle_bucket_++;
+                }
+                if (cycle_bucket_ >= refs.bucket_count())
+                {
+                    cycle_shard_++;
+                    cycle_bucket_ = 0;
+                }
+            }
+            spend();
+
+            size_t next = 0;
+            bool cut = false;
+            for (; (next < candidates.size()) && !exhausted; next++)
+            {
+                if (traces.emplace(candidates[next].second, CycleTrace()).second)
+                {
+                    objects.push_back(candidates[next]);
+                    frontier.push_back(candidates[next]);
+                }
+                // Objects that joined when the budget ran out are still
+                // counted, their children outside the step count as
+                // live from there.
+                while (!frontier.empty() && !exhausted)
+                {
+                    ControlBlock* block = frontier.back().second;
+                    frontier.pop_back();
+                    children.clear();
+                    block->type_->trace(block, tracer);
+                    spend();
+                    size_t j = 0;
+                    for (; (j < children.size()) && !exhausted; j++)
+                    {
+                        // Untraced children can't close a cycle, if one
+                        // frees them it releases them like any other.
+                        ControlBlock* child = children[j];
+                        if ((child->type_->trace == nullptr) || (traces.count(child) != 0))
+                        {
+                            continue;
+                        }
+                        // Pointers of the other threading policy
+                        // point into the other registry.
+                        const void* key = child->type_->address(child);
+                        Shard& shard = shard_for(key);
+                        Lock lock(shard.mutex_);
+                        typename RefContainer::iterator it = find(shard, key);
+                        if ((it != shard.refs_.end()) && (it->second == child))
+                        {
+                            traces.emplace(child, CycleTrace());
+                            objects.emplace_back(key, child);
+                            frontier.emplace_back(key, child);
+                        }
+                        spend();
+                    }
+                    cut = cut || (j < children.size());
+                }
+            }
+            // Cycles the budget cut off are whole when the next step
+            // starts with this bucket, only the first one of a step
+            // moves on regardless.
+            if (!first_bucket && (cut || !frontier.empty() || (next < candidates.size())))
+            {
+                cycle_shard_ = shard_before;
+                cycle_bucket_ = bucket_before;
+            }
+            frontier.clear();
+            first_bucket = false;
+        }
+
+        if (cycle_shard_ == Threading::shard_count)
+        {
+            cycle_shard_ = 0;
+            result.completed_pass = true;
+        }
+    }
+
+    reclaim_cycles(objects, traces, result);
+    return result;
+}
+
+template <class Threading>
+void Registry<Threading>::reclaim_cycles(const CycleObjects& objects, CycleMap& traces, CollectResult& result)
+{
+    struct CountTracer final : Tracer
+    {
+        CycleMap& traces_;
+
+        explicit CountTracer(CycleMap& traces) : traces_(traces) {}
+
+        bool visit(ControlBlock* child) override
+        {
+            typename CycleMap::iterator it = traces_.find(child);
+            if (it != traces_.end())
+            {
+                it->second.internal_++;
+            }
+            return false;
+        }
+    };
+
+    struct MarkTracer final : Tracer
+    {
+        CycleMap& traces_;
+        std::vector<ControlBlock*>& pending_;
+
+        MarkTracer(CycleMap& traces, std::vector<ControlBlock*>& pending) : traces_(traces), pending_(pending) {}
+
+        bool visit(ControlBlock* child) override
+        {
+            typename CycleMap::iterator it = traces_.find(child);
+            if ((it != traces_.end()) && !it->second.reachable_)
+            {
+                it->second.reachable_ = true;
+                pending_.push_back(child);
+            }
+            return false;
+        }
+    };
+
+    // Pointers between the garbage objects are dropped without a
+    // release, their targets are about to be destroyed anyway and
+    // may already be gone when a destructor would release them.
+    struct DropTracer final : Tracer
+    {
+        CycleMap& traces_;
+
+        explicit DropTracer(CycleMap& traces) : traces_(traces) {}
+
+        bool visit(ControlBlock* child) override
+        {
+            typename CycleMap::iterator it = traces_.find(child);
+            return (it != traces_.end()) && !it->second.reachable_;
+        }
+    };
+
+    // Objects outside the registry, buffered by other threads or
+    // managed with the other threading policy, don't show up here
+    // and count as outside references.
+    CountTracer count(traces);
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        ControlBlock* block = objects[i].second;
+        if (block->type_->trace != nullptr)
+        {
+            block->type_->trace(block, count);
+        }
+    }
+
+    std::vector<ControlBlock*> pending;
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        ControlBlock* block = objects[i].second;
+        CycleTrace& trace = traces[block];
+        if (block->ref_count_.load(std::memory_order_acquire) > trace.internal_)
+        {
+            trace.reachable_ = true;
+            pending.push_back(block);
+        }
+    }
+    MarkTracer mark(traces, pending);
+    while (!pending.empty())
+    {
+        ControlBlock* block = pending.back();
+        pending.pop_back();
+        if (block->type_->trace != nullptr)
+        {
+            block->type_->trace(block, mark);
+        }
+    }
+
+    std::vector<ControlBlock*> garbage;
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        ControlBlock* block = objects[i].second;
+        if (traces[block].reachable_)
+        {
+            continue;
+        }
+        garbage.push_back(block);
+        result.objects++;
+        result.bytes += block->bytes();
+
+        Shard& shard = shard_for(objects[i].first);
+        Lock lock(shard.mutex_);
+        shard.refs_.erase(objects[i].first);
+    }
+
+    DropTracer drop(traces);
+    for (size_t i = 0; i < garbage.size(); i++)
+    {
+        if (garbage[i]->type_->trace != nullptr)
+        {
+            garbage[i]->type_->trace(garbage[i], drop);
+        }
+    }
+    for (size_t i = 0; i < garbage.size(); i++)
+    {
+        dispose(garbage[i]);
+    }
+}
+
+// Clear refContainer when program exits.
+template <class Threading>
+void Registry<Threading>::shutdown()
+{
+    // Objects still queued for the background collector
+    // are freed before the rest of the heap.
+    if (Threading::background_collection)
+    {
+        background_collector().stop();
+    }
+
+    // Every entry gets freed no matter its reference count, so
+    // Pointers released by the destructors below must not touch
+    // control blocks that are already gone.
+    shutdown_.store(true);
+    tear_down(0, Threading::shard_count);
+}
+
+template <class Threading>
+void Registry<Threading>::shutdown_parallel(size_t threads)
+{
+    size_t workers = (threads < Threading::shard_count) ? threads : Threading::shard_count;
+    if (workers <= 1)
+    {
+        shutdown();
+        return;
+    }
+    // Destructors on the workers may release single threaded
+    // Pointers, which must not happen on several threads at once.
+    // That registry goes first and ignores them from then on.
+    if (!std::is_same<Threading, SingleThreaded>::value)
+    {
+        registry<SingleThreaded>().shutdown();
+    }
+    if (Threading::background_collection)
+    {
+        background_collector().stop();
+    }
+    shutdown_.store(true);
+
+    // If a thread can't be started its shards are
+    // torn down on this one.
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < workers; w++)
+    {
+        size_t first = w * Threading::shard_count / workers;
+        size_t last = (w + 1) * Threading::shard_count / workers;
+        try
+        {
+            pool.emplace_back([this, first, last]() { tear_down(first, last); });
+        }
+        catch (const std::system_error&)
+        {
+            tear_down(first, last);
+        }
+    }
+    tear_down(0, Threading::shard_count / workers);
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+        pool[i].join();
+    }
+}
+
+// The entries are moved to a map that is never destroyed, letting
+// go of a million of them would take as long as freeing the objects.
+template <class Threading>
+void Registry<Threading>::abandon()
+{
+    if (Threading::background_collection)
+    {
+        background_collector().stop();
+    }
+    shutdown_.store(true);
+    for (size_t i = 0; i < Threading::shard_count; i++)
+    {
+        Lock lock(shards_[i].mutex_);
+        if (!shards_[i].refs_.empty())
+        {
+            new RefContainer(std::move(shards_[i].refs_));
+        }
+        if (!shards_[i].young_.empty())
+        {
+            new std::vector<YoungEntry>(std::move(shards_[i].young_));
+        }
+    }
+}
+
+template <class Threading>
+void Registry<Threading>::tear_down(size_t first, size_t last)
+{
+    std::vector<ControlBlock*> garbage;
+    for (size_t i = first; i < last; i++)
+    {
+        Lock lock(shards_[i].mutex_);
+        RefContainer& refs = shards_[i].refs_;
+        // Erasing the first entry takes constant time, entries are
+        // collected and their nodes freed in a single walk.
+        while (!refs.empty())
+        {
+            typename RefContainer::iterator p = refs.begin();
+            garbage.push_back(p->second);
+            refs.erase(p);
+        }
+        for (size_t j = 0; j < shards_[i].young_.size(); j++)
+        {
+            garbage.push_back(shards_[i].young_[j].block_);
+        }
+        // Hand the bucket array back as well, otherwise it
+        // outlives the leak report.
+        RefContainer().swap(refs);
+        std::vector<YoungEntry>().swap(shards_[i].young_);
+        std::vector<size_t>().swap(shards_[i].young_index_);
+    }
+
+    for (size_t i = 0; i < garbage.size(); i++)
+    {
+        garbage[i]->type_->destroy(garbage[i]);
+    }
+}
+
+template <class Threading>
+template <class F>
+void Registry<Threading>::for_each(F f)
+{
+    for (size_t i = 0; i < Threading::shard_count; i++)
+    {
+        Lock lock(shards_[i].mutex_);
+        typename RefContainer::iterator p;
+        for (p = shards_[i].refs_.begin(); p != shards_[i].refs_.end(); p++)
+        {
+            f(p->first, p->second);
+        }
+        for (size_t j = 0; j < shards_[i].young_.size(); j++)
+        {
+            f(shards_[i].young_[j].key_, shards_[i].young_[j].block_);
+        }
+    }
+}
+
+template <class Threading>
+template <class Key>
+void Registry<Threading>::group_by_shard(size_t count, Key key, std::vector<size_t>& order,
+                                         std::vector<size_t>& starts)
+{
+    starts.assign(Threading::shard_count + 1, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        starts[shard_index(key(i)) + 1]++;
+    }
+    for (size_t s = 0; s < Threading::shard_count; s++)
+    {
+        starts[s + 1] += starts[s];
+    }
+    std::vector<size_t> next(starts.begin(), starts.end() - 1);
+    order.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        order[next[shard_index(key(i))]++] = i;
+    }
+}
+
+// Pick the registry shard responsible for ptr.
+template <class Threading>
+size_t Registry<Threading>::shard_index(const void* ptr)
+{
+    // Allocations are aligned, drop the low bits before spreading
+    uintptr_t key = reinterpret_cast<uintptr_t>(ptr) >> 4;
+    return (key ^ (key >> 8)) % Threading::shard_count;
+}
+
+} // namespace gc
+
+#endif
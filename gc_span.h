@@ -0,0 +1,75 @@
+#ifndef GC_SPAN_H
+#define GC_SPAN_H
+
+#include <cstddef>
+#include <type_traits>
+
+namespace gc {
+
+// View of the contiguous elements behind a Pointer, what std::span
+// is in C++20. Its iterators are plain pointers, so standard
+// algorithms and the vectorizer see an ordinary array and nothing
+// is bounds checked. Like Iter, a Span doesn't keep the memory
+// alive, the Pointer it came from must outlive it.
+template <class T>
+class Span
+{
+    public:
+        using element_type = T;
+        using value_type = typename std::remove_cv<T>::type;
+        using size_type = size_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T*;
+        using reference = T&;
+        using iterator = T*;
+
+        Span() noexcept = default;
+
+        Span(T* data, size_t size) noexcept : data_(data), size_(size)
+        {
+        }
+
+        T* data() const noexcept
+        {
+            return data_;
+        }
+
+        size_t size() const noexcept
+        {
+            return size_;
+        }
+
+        bool empty() const noexcept
+        {
+            return size_ == 0;
+        }
+
+        T* begin() const noexcept
+        {
+            return data_;
+        }
+
+        T* end() const noexcept
+        {
+            return data_ + size_;
+        }
+
+        T& operator[](size_t index) const noexcept
+        {
+            return data_[index];
+        }
+
+        // View of count elements starting at offset.
+        Span subspan(size_t offset, size_t count) const noexcept
+        {
+            return Span(data_ + offset, count);
+        }
+
+    private:
+        T* data_ = nullptr;
+        size_t size_ = 0;
+};
+
+} // namespace gc
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef GC_THREADING_H
+#define GC_THREADING_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace gc {
+
+// Settings for the per-thread caches of ConcurrentPointer.
+struct ThreadCacheConfig
+{
+    // Registrations a thread buffers before publishing them to the
+    // shared registry, also the number of free control blocks it
+    // keeps for reuse. 0 disables the cache.
+    std::atomic<size_t> cache_size{0};
+    // Adoptions after which the buffer is published even if it
+    // isn't full yet. 0 publishes only when the buffer is full.
+    std::atomic<size_t> flush_interval{0};
+};
+
+inline ThreadCacheConfig& thread_cache_config()
+{
+    static ThreadCacheConfig config;
+    return config;
+}
+
+// Enable the per-thread caches. Allocating, using and dropping an
+// object on one thread then never touches shared state, buffered
+// objects become visible to collect() and raw pointer lookups from
+// other threads once their thread flushes. Like std::shared_ptr,
+// a raw pointer must then be adopted only once; share the Pointer
+// instead of adopting the same memory again.
+inline void set_thread_cache(size_t cache_size, size_t flush_interval)
+{
+    thread_cache_config().cache_size.store(cache_size);
+    thread_cache_config().flush_interval.store(flush_interval);
+}
+
+// Lock that does nothing, used when a Pointer never crosses threads.
+struct NullMutex
+{
+    void lock() {}
+    void unlock() {}
+};
+
+// Threading policies for Pointer. They decide how the reference
+// counts in a control block are updated and how the registry
+// behind a Pointer type is guarded.
+
+// Pointers that stay on one thread. Counters are only loaded and
+// stored, which compiles down to a plain increment, and the
+// registry is a single unlocked shard.
+struct SingleThreaded
+{
+    using mutex_type = NullMutex;
+    static const size_t shard_count = 1;
+    // The registry is private to the thread already.
+    static const bool buffer_registrations = false;
+    // Objects must be freed on the thread that uses them.
+    static const bool background_collection = false;
+
+    // Storage shared by the whole program, or nullptr once
+    // it was destroyed during exit.
+    template <class X>
+    static X* local()
+    {
+        static bool destroyed = false;
+        struct Holder
+        {
+            X x;
+            ~Holder() { destroyed = true; }
+        };
+        static Holder holder;
+        return destroyed ? nullptr : &holder.x;
+    }
+
+    static void add(std::atomic<size_t>& counter, size_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static void subtract(std::atomic<size_t>& counter, size_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+    }
+
+    // Returns the value after the decrement.
+    static size_t decrement(std::atomic<size_t>& counter)
+    {
+        size_t value = counter.load(std::memory_order_relaxed) - 1;
+        counter.store(value, std::memory_order_relaxed);
+        return value;
+    }
+
+    // Increment unless the counter is zero, returns
+    // whether it was incremented.
+    static bool add_if_nonzero(std::atomic<size_t>& counter)
+    {
+        size_t value = counter.load(std::memory_order_relaxed);
+        if (value == 0)
+        {
+            return false;
+        }
+        counter.store(value + 1, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+// Pointers shared between threads. Counters use atomic read-modify-write
+// and the registry is split in independently locked shards, so adopting
+// and releasing different objects rarely contends on the same lock.
+struct MultiThreaded
+{
+    using mutex_type = std::mutex;
+    static const size_t shard_count = 64;
+    static const bool buffer_registrations = true;
+    static const bool background_collection = true;
+
+    // Storage private to the calling thread, or nullptr once
+    // the thread started to exit and destroyed it.
+    template <class X>
+    static X* local()
+    {
+        thread_local bool destroyed = false;
+        struct Holder
+        {
+            X x;
+            ~Holder() { destroyed = true; }
+        };
+        thread_local Holder holder;
+        return destroyed ? nullptr : &holder.x;
+    }
+
+    static void add(std::atomic<size_t>& counter, size_t n)
+    {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void subtract(std::atomic<size_t>& counter, size_t n)
+    {
+        counter.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    // Returns the value after the decrement. Acquire/release ordering
+    // makes every use of the object happen before it is freed.
+    static size_t decrement(std::atomic<size_t>& counter)
+    {
+        return counter.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    // Increment unless the counter is zero, returns
+    // whether it was incremented.
+    static bool add_if_nonzero(std::atomic<size_t>& counter)
+    {
+        size_t value = counter.load(std::memory_order_relaxed);
+        while (value != 0)
+        {
+            if (counter.compare_exchange_weak(value, value + 1, std::memory_order_acquire,
+                                              std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace gc
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef GC_TRACE_H
+#define GC_TRACE_H
+
+namespace gc {
+
+// Tells collect_cycles() which Pointers an object holds. Types
+// that may end up in a cycle specialize it, for example
+//
+//     namespace gc {
+//     template <>
+//     struct Children<Node>
+//     {
+//         static const bool traced = true;
+//
+//         template <class Visitor>
+//         static void visit(Node& node, Visitor& visitor)
+//         {
+//             visitor(node.next);
+//             visitor(node.prev);
+//         }
+//     };
+//     } // namespace gc
+//
+// Every Pointer member must be handed to the visitor, one that is
+// left out is treated as a reference from outside the heap and keeps
+// its target alive. Cycles may run through any Pointer types that
+// share a threading policy.
+template <class T>
+struct Children
+{
+    static const bool traced = false;
+
+    template <class Visitor>
+    static void visit(T&, Visitor&)
+    {
+    }
+};
+
+class ControlBlock;
+
+// Receives the children of traced objects while the
+// registry looks for cycles.
+class Tracer
+{
+    public:
+        // Returning true makes the Pointer let go of child
+        // without releasing its reference.
+        virtual bool visit(ControlBlock* child) = 0;
+
+    protected:
+        ~Tracer() = default;
+};
+
+} // namespace gc
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef GC_WEAK_H
+#define GC_WEAK_H
+
+#include "gc_pointer.h"
+
+/*
+    WeakPointer refers to the object of a Pointer
+    without keeping it alive, collect() may free it
+    like any other unreferenced object. lock() gives
+    a Pointer to the object, or a null Pointer once
+    it is gone, which makes it the building block
+    for caches. Only the control block is kept until
+    the last WeakPointer lets go; for objects built
+    by make_gc() that is the object's chunk as well.
+*/
+
+template <class T, int size = 0, class Threading = gc::SingleThreaded>
+class WeakPointer
+{
+
+private:
+    using Strong = Pointer<T, size, Threading>;
+
+    PtrDetails<T>* details_ = nullptr;
+
+    void acquire(PtrDetails<T>* details);
+    void release();
+
+public:
+    WeakPointer() noexcept = default;
+    WeakPointer(const Strong& strong);
+    WeakPointer(const WeakPointer& rhs);
+    WeakPointer(WeakPointer&& rhs) noexcept;
+    ~WeakPointer();
+
+    WeakPointer& operator=(const Strong& strong);
+    WeakPointer& operator=(const WeakPointer& rhs);
+    WeakPointer& operator=(WeakPointer&& rhs) noexcept;
+
+    // A Pointer to the object, null if nothing refers to it
+    // any more. An object without references that is still
+    // waiting for collect() counts as gone.
+    Strong lock() const;
+
+    bool expired() const
+    {
+        return (details_ == nullptr) || (details_->ref_count_.load(std::memory_order_acquire) == 0);
+    }
+
+    // Stop referring to the object.
+    void reset()
+    {
+        release();
+    }
+};
+
+// A WeakPointer for ConcurrentPointers.
+template <class T, int size = 0>
+using ConcurrentWeakPointer = WeakPointer<T, size, gc::MultiThreaded>;
+
+// WeakPointer to a Pointer<T[]>, a WeakPointer<T, gc::dynamic_size>
+// under the same name as its Pointer.
+template <class T, int size, class Threading>
+class WeakPointer<T[], size, Threading> : public WeakPointer<T, gc::dynamic_size, Threading>
+{
+    static_assert(size == 0, "Pointer<T[]> takes its length at run time");
+    using Base = WeakPointer<T, gc::dynamic_size, Threading>;
+
+public:
+    using Base::Base;
+    using Base::operator=;
+
+    WeakPointer() noexcept = default;
+
+    Pointer<T[], 0, Threading> lock() const
+    {
+        return Base::lock();
+    }
+};
+
+template <class T, int size, class Threading>
+WeakPointer<T, size, Threading>::WeakPointer(const Strong& strong)
+{
+    static_assert(!gc::IsIntrusive<T>::value, "intrusive objects have no weak count");
+    acquire(strong.details_);
+}
+
+template <class T, int size, class Threading>
+WeakPointer<T, size, Threading>::WeakPointer(const WeakPointer& rhs)
+{
+    acquire(rhs.details_);
+}
+
+template <class T, int size, class Threading>
+WeakPointer<T, size, Threading>::WeakPointer(WeakPointer&& rhs) noexcept
+{
+    details_ = rhs.details_;
+    rhs.details_ = nullptr;
+}
+
+template <class T, int size, class Threading>
+WeakPointer<T, size, Threading>::~WeakPointer()
+{
+    release();
+}
+
+template <class T, int size, class Threading>
+WeakPointer<T, size, Threading>& WeakPointer<T, size, Threading>::operator=(const Strong& strong)
+{
+    if (details_ != strong.details_)
+    {
+        release();
+        acquire(strong.details_);
+    }
+    return *this;
+}
+
+template <class T, int size, class Threading>
+WeakPointer<T, size, Threading>& WeakPointer<T, size, Threading>::operator=(const WeakPointer& rhs)
+{
+    if (details_ != rhs.details_)
+    {
+        release();
+        acquire(rhs.details_);
+    }
+    return *this;
+}
+
+template <class T, int size, class Threading>
+WeakPointer<T, size, Threading>& WeakPointer<T, size, Threading>::operator=(WeakPointer&& rhs) noexcept
+{
+    if (this != &rhs)
+    {
+        release();
+        details_ = rhs.details_;
+        rhs.details_ = nullptr;
+    }
+    return *this;
+}
+
+template <class T, int size, class Threading>
+Pointer<T, size, Threading> WeakPointer<T, size, Threading>::lock() const
+{
+    // Only a live object may gain a reference, once the count
+    // reached zero the object is garbage even if it still exists.
+    if ((details_ == nullptr) || !Threading::add_if_nonzero(details_->ref_count_))
+    {
+        return Strong();
+    }
+    Strong::registry().note_ref_op();
+    return Strong(details_, typename Strong::FromDetails());
+}
+
+template <class T, int size, class Threading>
+void WeakPointer<T, size, Threading>::acquire(PtrDetails<T>* details)
+{
+    details_ = details;
+    if (details_ != nullptr)
+    {
+        Threading::add(details_->weak_count_, 1);
+    }
+}
+
+template <class T, int size, class Threading>
+void WeakPointer<T, size, Threading>::release()
+{
+    PtrDetails<T>* details = details_;
+    details_ = nullptr;
+    // shutdown() freed the block no matter its weak count.
+    if ((details != nullptr) && !Strong::registry().shutting_down())
+    {
+        Strong::release_block(details);
+    }
+}
+
+#endif
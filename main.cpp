@@ -1,11 +1,110 @@
 #include "gc_pointer.h"
+#include "gc_weak.h"
 #include "LeakTester.h"
 
+// Two of them pointing at each other only go away
+// through collect_cycles().
+struct Ring
+{
+    Pointer<Ring> next;
+};
+
+namespace gc {
+template <>
+struct Children<Ring>
+{
+    static const bool traced = true;
+
+    template <class Visitor>
+    static void visit(Ring& ring, Visitor& visitor)
+    {
+        visitor(ring.next);
+    }
+};
+} // namespace gc
+
 int main()
 {
     Pointer<int> p = new int(19);
     p = new int(21);
     p = new int(28);
 
+    // Memory of unknown length is refused, not registered,
+    // and the caller still owns it.
+    Pointer<int[]> buffer(new int[4], 4);
+    int* raw = new int[8];
+    try
+    {
+        Pointer<int[]> unknown(raw);
+        return 1;
+    }
+    catch (const std::invalid_argument&)
+    {
+    }
+    buffer[0] = 7;
+    try
+    {
+        buffer = raw;
+        return 1;
+    }
+    catch (const std::invalid_argument&)
+    {
+    }
+    delete[] raw;
+    // A refused assignment keeps what the Pointer held.
+    if ((buffer.span().size() != 4) || (buffer[0] != 7))
+    {
+        return 1;
+    }
+    // Managed memory picks up its recorded length.
+    buffer = Pointer<int[]>(new int[4], 4);
+    Pointer<int[]> alias(&buffer[0]);
+    if (alias.span().size() != 4)
+    {
+        return 1;
+    }
+    // The other registry doesn't know it, refusing
+    // must not free it under buffer.
+    try
+    {
+        Pointer<int[], 0, gc::MultiThreaded> stranger(&buffer[0]);
+        return 1;
+    }
+    catch (const std::invalid_argument&)
+    {
+    }
+    buffer[0] = 1;
+
+    // Weak references to dynamic arrays lock to the same length.
+    WeakPointer<int[]> weak = buffer;
+    if (weak.lock().span().size() != 4)
+    {
+        return 1;
+    }
+
+    // Pointers that only differ in their other policies
+    // share the registry and its objects.
+    {
+        using Explicit = gc::Policy<gc::SingleThreaded, gc::FixedCollection<gc::CollectPolicy::Explicit> >;
+        Pointer<int> shared = make_gc<int>(5);
+        Pointer<int, 0, Explicit> other(&*shared);
+        if ((*other != 5) || (Pointer<int, 0, Explicit>::ref_container_size() != Pointer<int>::ref_container_size()))
+        {
+            return 1;
+        }
+    }
+
+    // A full cycle collection sees the whole heap.
+    {
+        Pointer<Ring> ring = make_gc<Ring>();
+        ring->next = make_gc<Ring>();
+        ring->next->next = ring;
+    }
+    gc::CollectResult freed = gc::collect_cycles();
+    if ((freed.objects != 2) || !freed.completed_pass)
+    {
+        return 1;
+    }
+
     return 0;
 }
\ No newline at end of file